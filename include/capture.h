@@ -0,0 +1,93 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+// Input capture on a timer's CAP0 input.
+//
+// Each edge is timestamped by the hardware and collected in the capture
+// interrupt, which alternates between rising and falling edges. Counts
+// are extended across timer wrap in software, so long periods can be
+// measured on the 16-bit timers. Period and high time are averaged over
+// a configurable number of cycles before being published.
+//
+// The input must not change faster than the interrupt can follow; each
+// edge costs one interrupt. An edge that arrives before the interrupt has
+// re-armed the capture for it is detected from the pin level; the cycle
+// in progress is discarded and counted as missed. The CAP0 pin must be
+// configured separately.
+
+#include "timer.h"
+
+class Capture : public Timer
+{
+public:
+    constexpr Capture(unsigned index) :
+        Timer(index)
+    {}
+
+    // Start measuring, with the timer counting at PCLK / prescale, and
+    // averaging over cycles periods.
+    void                configure(unsigned cycles = 1, unsigned prescale = 1);
+
+    // Latest averaged measurement, in timer ticks.
+    struct Measurement {
+        uint32_t            period;
+        uint32_t            width;          // high time
+        unsigned            sequence;       // increments with each update
+        unsigned            missed;         // cycles discarded for lost edges
+    };
+
+    // Returns false if nothing has been measured yet.
+    bool                measurement(Measurement &result);
+
+    uint32_t            tick_rate() const { return Syscon::PCLK_FREQ / (_regs.PR + 1); }
+
+    // Conveniences; zero if there is no measurement.
+    uint32_t            frequency();        // Hz
+    uint32_t            period_us();
+    uint32_t            width_us();
+
+private:
+    struct State {
+        uint32_t            wraps;
+        bool                started;        // seen a rising edge
+        uint64_t            lastRise;
+        uint64_t            lastFall;
+        unsigned            cycles;
+        unsigned            count;
+        uint64_t            sumPeriod;
+        uint64_t            sumWidth;
+        Measurement         result;
+    };
+    static State        _state[4];
+
+    void                edge_select(bool rising);
+    bool                input();
+    static void         wrap(unsigned index, Channel channel, void *context);
+    static void         edge(unsigned index, Channel channel, void *context);
+};
@@ -36,4 +36,30 @@
 
 #define CONFIG_TIMEBASE_TIMER       0
 
+#define CONFIG_I2C_TIMEOUT_US       10000   // base timeout for a transfer
+#define CONFIG_I2C_BYTE_TIMEOUT_US  100     // additional timeout per byte transferred
+#define CONFIG_I2C_STATS_SLAVES     0       // number of slaves to keep transfer statistics for
+#define CONFIG_I2C_POLL_MAX_BYTES   2       // transfers up to this size are polled
+
+#define CONFIG_EEPROM_WRITE_TIMEOUT_US  10000   // maximum EEPROM write cycle time
+
+#define CONFIG_SPI_FLASH_CACHE_SIZE         32      // read-ahead cache size in bytes
+#define CONFIG_SPI_FLASH_PROGRAM_TIMEOUT_US 5000    // maximum page program time
+#define CONFIG_SPI_FLASH_ERASE_TIMEOUT_US   500000  // maximum sector erase time
+
+#define CONFIG_SD_CRC                   0       // check CRCs on SD card commands and data
+#define CONFIG_SD_INIT_TIMEOUT_US       1000000 // maximum SD card initialisation time
+#define CONFIG_SD_READ_TIMEOUT_US       100000  // maximum time to wait for a block to be read
+#define CONFIG_SD_WRITE_TIMEOUT_US      500000  // maximum time to wait for a block to be written
+
+#define CONFIG_DISPLAY_DIRTY_RECTS      4       // dirty rectangles tracked before merging
+#define CONFIG_DISPLAY_LINE_PIXELS      64      // pixels rendered per scanline chunk
+
+#define CONFIG_SHIFT_CHAIN_MAX_BYTES    8       // longest shift-register chain
+
 #define CONFIG_ETL_NUM_CALLBACK_TIMERS  4
+
+#define CONFIG_DEADLINE_TIMERS          8       // maximum number of active deadline timers
+
+#define CONFIG_TICKLESS_IDLE            0       // stop the OS tick while idle (needs Timebase)
+#define CONFIG_TICKLESS_MAX_TICKS       1000    // longest tickless sleep in OS ticks
@@ -0,0 +1,78 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+// External event counter.
+//
+// The timer counts edges on its CAP0 input in hardware, so counting costs
+// no CPU time beyond one interrupt per counter wrap; the count is extended
+// to 64 bits in software. Optionally, a callback can be made every N
+// events using a match register.
+//
+// The input must be slower than half of PCLK. The CAP0 pin must be
+// configured separately.
+
+#include "timer.h"
+
+class Counter : public Timer
+{
+public:
+    enum Edge {
+        RISING,
+        FALLING,
+        BOTH,
+    };
+
+    constexpr Counter(unsigned index) :
+        Timer(index)
+    {}
+
+    // Start counting from zero.
+    void                configure(Edge edge = RISING);
+
+    // Events counted so far.
+    uint64_t            count();
+
+    // Call callback (from interrupt context) every events events, counting
+    // from now; zero stops the callbacks.
+    void                every(uint32_t events, Callback callback, void *context = nullptr);
+
+private:
+    struct State {
+        uint32_t            wraps;
+        uint32_t            interval;
+        uint64_t            next;
+        Callback            callback;
+        void                *context;
+    };
+    static State        _state[4];
+
+    void                set_match();
+    static void         wrap(unsigned index, Channel channel, void *context);
+    static void         match(unsigned index, Channel channel, void *context);
+};
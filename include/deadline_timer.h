@@ -0,0 +1,81 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+// Microsecond-resolution one-shot and periodic timers.
+//
+// Active timers are kept in a binary min-heap ordered by deadline, and the
+// earliest deadline is programmed into a Timebase match register, so
+// callbacks run when due rather than on the next millisecond tick, and
+// there is no interrupt at all while nothing is pending.
+//
+// Callbacks run in the Timebase interrupt and may start or stop any timer,
+// including their own.
+
+#include "config.h"
+#include "timer.h"
+
+class DeadlineTimer
+{
+public:
+    typedef void (* Callback)(void *context);
+
+    constexpr DeadlineTimer(Callback callback, void *context = nullptr) :
+        _callback(callback),
+        _context(context)
+    {}
+
+    // Fire after delay microseconds, and then every period microseconds
+    // if period is not zero. Restarts the timer if already active.
+    // Returns false if too many timers are active.
+    bool                start(uint32_t delay, uint32_t period = 0);
+
+    // Fire at an absolute time.
+    bool                start_at(_Timebase::microseconds when, uint32_t period = 0);
+
+    void                stop();
+    bool                active() const { return _slot >= 0; }
+
+private:
+    const Callback          _callback;
+    void                    *const _context;
+    _Timebase::microseconds _due = 0;
+    uint32_t                _period = 0;
+    int                     _slot = -1;     // heap index if active
+
+    static DeadlineTimer    *_heap[CONFIG_DEADLINE_TIMERS];
+    static unsigned         _count;
+
+    static void             insert(DeadlineTimer *timer);
+    static void             remove(DeadlineTimer *timer);
+    static void             place(DeadlineTimer *timer, unsigned slot);
+    static void             sift_up(unsigned slot);
+    static void             sift_down(unsigned slot);
+    static void             reprogram();
+    static void             expire(unsigned index, Timer::Channel channel, void *context);
+};
@@ -0,0 +1,84 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+// 24Cxx-style I2C EEPROMs.
+//
+// Parts up to 2KiB (24C16) use an 8-bit word address and borrow the low
+// slave address bits for the upper address bits; larger parts use a 16-bit
+// word address, with parts over 64KiB borrowing a slave address bit for
+// bit 16.
+//
+// Write cycle completion is detected by ACK polling; the device NACKs its
+// address until the cycle is done. Rather than polling after every write,
+// the next operation is simply retried until it is ACKed.
+
+#include "i2c.h"
+
+class EEPROM
+{
+public:
+    constexpr EEPROM(I2C &bus,
+                     uint8_t slave,
+                     uint32_t size,
+                     uint16_t pageSize) :
+        _bus(bus),
+        _slave(slave),
+        _size(size),
+        _pageSize(pageSize),
+        _addressing((size > 2048) ? I2C::ADDRESS_16BIT : I2C::ADDRESS_8BIT)
+    {}
+
+    // Read length bytes starting at address; one sequential read per
+    // address block (256B or 64KiB depending on the part).
+    I2C::State          read(uint32_t address, uint8_t *buffer, uint32_t length);
+
+    // Write length bytes starting at address, split at page boundaries.
+    I2C::State          write(uint32_t address, const uint8_t *buffer, uint32_t length);
+
+    // Wait for any outstanding write cycle to complete.
+    I2C::State          sync();
+
+    uint32_t            size() const { return _size; }
+
+private:
+    I2C                     &_bus;
+    const uint8_t           _slave;
+    const uint32_t          _size;
+    const uint16_t          _pageSize;
+    const I2C::Addressing   _addressing;
+    bool                    _writePending = false;
+    uint64_t                _writeDeadline = 0;
+
+    I2C::State          transfer(uint32_t address,
+                                 const uint8_t *writeBuffer,
+                                 uint16_t writeLength,
+                                 uint8_t *readBuffer,
+                                 uint16_t readLength);
+
+    uint32_t            block_size() const { return (_addressing == I2C::ADDRESS_16BIT) ? 0x10000 : 0x100; }
+};
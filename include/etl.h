@@ -38,6 +38,9 @@ namespace ETL
 void init(void);
 void millisecond_tick();
 
+// Milliseconds until the next callback timer expires; UINT32_MAX if none.
+uint32_t ticks_to_next();
+
 #if CONFIG_ETL_NUM_CALLBACK_TIMERS > 0
 extern etl::callback_timer<CONFIG_ETL_NUM_CALLBACK_TIMERS>  callback_timer;
 #endif
@@ -34,9 +34,25 @@
 
 #include <LPC11xx.h>
 
+#include "config.h"
+
+#ifdef WITH_SCMRTOS
+# include <scmRTOS.h>
+#endif
+
 extern "C" void I2C_Handler(void);
 
 /// I2C master mode
+///
+/// Without scmRTOS, a transfer attempted while another is in progress
+/// (e.g. from an interrupt handler) fails with ERROR. With scmRTOS, callers
+/// block until the bus is free, and sleep while their transfer is running.
+///
+/// Short transfers (see setPollThreshold) are run by polling the controller
+/// rather than taking an interrupt per bus event. Transfers made from an
+/// interrupt handler, with interrupts masked, or before scmRTOS is running
+/// (e.g. from board_init), are always polled and never block; if the bus
+/// is busy they fail with ERROR.
 class I2C
 {
 public:
@@ -49,51 +65,184 @@ public:
         TERMINAL_STATE,
         ACK,
         NACK,
-        ERROR
+        ERROR,
+        TIMEOUT,                // transfer timed out, bus could not be recovered
+        RECOVERED               // transfer timed out, bus was recovered
+    };
+
+    // Register address width for the register access helpers.
+    enum Addressing : uint8_t {
+        ADDRESS_8BIT = 1,
+        ADDRESS_16BIT = 2,          // sent MSB first
     };
 
-    State                    transfer(uint8_t slave,
-                                      uint8_t *writeBuffer,
-                                      uint8_t writeLength,
-                                      uint8_t *readBuffer = nullptr,
-                                      uint8_t readLength = 0);
+    // Byte order on the wire for multi-byte register values.
+    enum ByteOrder : uint8_t {
+        VALUE_BE,
+        VALUE_LE,
+    };
+
+    // Write writeBuffer, then read into readBuffer using a repeated START.
+    State                   transfer(uint8_t slave,
+                                     const uint8_t *writeBuffer,
+                                     uint16_t writeLength,
+                                     uint8_t *readBuffer = nullptr,
+                                     uint16_t readLength = 0)
+    {
+        return transfer(slave, nullptr, 0, writeBuffer, writeLength, readBuffer, readLength);
+    }
+
+    // Scatter-gather transfer; headerBuffer and writeBuffer are sent back to
+    // back in a single write phase. Payload bytes (but not header bytes) are
+    // addressed as (index ^ swap), so a swap of 1 or 3 byte-swaps 16 or 32-bit
+    // elements in flight.
+    State                   transfer(uint8_t slave,
+                                     const uint8_t *headerBuffer,
+                                     uint16_t headerLength,
+                                     const uint8_t *writeBuffer,
+                                     uint16_t writeLength,
+                                     uint8_t *readBuffer,
+                                     uint16_t readLength,
+                                     uint8_t swap = 0);
 
-    template<typename TADDR, typename TVALUE>
-    State                   writeRegister(uint8_t slave, TADDR address, TVALUE value)
+    // Write count consecutive registers starting at address.
+    template<typename TVALUE>
+    State                   writeRegisters(uint8_t slave,
+                                           uint16_t address,
+                                           const TVALUE *values,
+                                           uint8_t count,
+                                           Addressing addressing = ADDRESS_8BIT,
+                                           ByteOrder order = VALUE_BE)
     {
-        uint8_t buffer[] = { (uint8_t)(address & 0x7f), (uint8_t)(value & 0xff) };
+        uint8_t header[] = { (uint8_t)(address >> 8), (uint8_t)(address & 0xff) };
 
-        return transfer(slave, buffer, sizeof(buffer));
+        return transfer(slave,
+                        header + sizeof(header) - addressing, addressing,
+                        reinterpret_cast<const uint8_t *>(values), count * sizeof(TVALUE),
+                        nullptr, 0,
+                        swap_mask<TVALUE>(order));
     }
 
-    template<typename TADDR, typename TVALUE>
-    State                   readRegister(uint8_t slave, TADDR address, TVALUE &value)
+    // Read count consecutive registers starting at address.
+    template<typename TVALUE>
+    State                   readRegisters(uint8_t slave,
+                                          uint16_t address,
+                                          TVALUE *values,
+                                          uint8_t count,
+                                          Addressing addressing = ADDRESS_8BIT,
+                                          ByteOrder order = VALUE_BE)
     {
-        uint8_t abuffer[] = { (uint8_t)(address & 0x7f) };
-        uint8_t vbuffer[] = { 0 };
+        uint8_t header[] = { (uint8_t)(address >> 8), (uint8_t)(address & 0xff) };
+
+        return transfer(slave,
+                        header + sizeof(header) - addressing, addressing,
+                        nullptr, 0,
+                        reinterpret_cast<uint8_t *>(values), count * sizeof(TVALUE),
+                        swap_mask<TVALUE>(order));
+    }
 
-        auto result = transfer(slave, abuffer, 1, vbuffer, 1);
-        value = vbuffer[0];
-        return result;
+    // Single-register access. The value type is never deduced from the
+    // argument, so that writeRegister(slave, reg, 1) writes one byte; pass
+    // it explicitly for wider registers, e.g. writeRegister<uint16_t>().
+    template<typename T>
+    struct NonDeduced {
+        typedef T type;
+    };
+
+    template<typename TVALUE = uint8_t>
+    State                   writeRegister(uint8_t slave,
+                                          uint16_t address,
+                                          typename NonDeduced<TVALUE>::type value,
+                                          Addressing addressing = ADDRESS_8BIT,
+                                          ByteOrder order = VALUE_BE)
+    {
+        return writeRegisters(slave, address, &value, 1, addressing, order);
     }
 
+    template<typename TVALUE = uint8_t>
+    State                   readRegister(uint8_t slave,
+                                         uint16_t address,
+                                         typename NonDeduced<TVALUE>::type &value,
+                                         Addressing addressing = ADDRESS_8BIT,
+                                         ByteOrder order = VALUE_BE)
+    {
+        return readRegisters(slave, address, &value, 1, addressing, order);
+    }
+
+    // Transfers moving no more than this many bytes (header, write and read
+    // combined) are polled. 0 polls only address probes, 0xffff always polls.
+    void                    setPollThreshold(uint16_t bytes) { _pollThreshold = bytes; }
+
+#if CONFIG_I2C_STATS_SLAVES > 0
+    static const unsigned   STATS_BUCKETS = 16;
+
+    // Per-slave transfer statistics.
+    struct Stats {
+        uint8_t             slave;
+        uint32_t            transfers;
+        uint32_t            nacks;
+        uint32_t            arbitration_losses;
+        uint32_t            timeouts;                   // includes RECOVERED
+        uint32_t            interrupt_us;               // time servicing the controller, polled or not
+        uint32_t            latency[STATS_BUCKETS];     // [n] counts transfers taking < 2^n us
+    };
+
+    const Stats             *stats(uint8_t slave) const;
+    void                    dumpStats() const;
+    void                    resetStats();
+#endif
+
     friend void I2C_Handler(void);
 
 private:
 
     etl::atomic<bool>                               _busy;
+#ifdef WITH_SCMRTOS
+    OS::TMutex                                      _lock;
+    OS::TEventFlag                                  _done;
+#endif
+
+#if CONFIG_I2C_STATS_SLAVES > 0
+    Stats                                           _stats[CONFIG_I2C_STATS_SLAVES];
+    uint32_t                                        _interruptTime;
+    bool                                            _arbitrationLost;
+#endif
 
-    State                                           _state = IDLE;
+    volatile State                                  _state = IDLE;
+    bool                                            _polled = false;
+    uint16_t                                        _pollThreshold = CONFIG_I2C_POLL_MAX_BYTES;
     uint8_t                                         _slave = 0;
-    etl::array_view<uint8_t>                        _writeBuffer;
-    etl::array_view<uint8_t>::iterator              _writeIter;
+    uint8_t                                         _swap = 0;
+    etl::array_view<const uint8_t>                  _headerBuffer;
+    etl::array_view<const uint8_t>::const_iterator  _headerIter;
+    etl::array_view<const uint8_t>                  _writeBuffer;
+    unsigned                                        _writeIndex;
     etl::array_view<uint8_t>                        _readBuffer;
-    etl::array_view<uint8_t>::iterator              _readIter;
+    unsigned                                        _readIndex;
+
+    template<typename TVALUE>
+    static constexpr uint8_t swap_mask(ByteOrder order)
+    {
+        static_assert((sizeof(TVALUE) == 1) || (sizeof(TVALUE) == 2) || (sizeof(TVALUE) == 4),
+                      "register values must be 1, 2 or 4 bytes");
+
+        // we are little-endian, so only big-endian values need swapping
+        return (order == VALUE_BE) ? (sizeof(TVALUE) - 1) : 0;
+    }
 
     void                    transfer();
-    bool                    start();
-    bool                    stop();
+    void                    init();
+    bool                    start(uint64_t deadline);
+    void                    wait(uint64_t deadline);
+    bool                    expire(State reached);
+    void                    poll();
+    bool                    stop(uint64_t deadline);
+    bool                    recover();
     void                    handleInterrupt();
+    bool                    sendNext();
+#if CONFIG_I2C_STATS_SLAVES > 0
+    void                    recordStats(uint64_t startTime, State result);
+#endif
 
     enum I2CCONSET : uint32_t {
         CONSET_AA_MASK                  = 0x00000004,
@@ -0,0 +1,228 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+// Shadow register file for an I2C device.
+//
+// Keeps a copy of the device's registers so that configuration changes
+// don't need a bus read, and writes only the registers that have changed
+// when flushed. Registers marked volatile (status, data, etc.) always go
+// to the device.
+//
+// The device must auto-increment its register address for burst access.
+
+#include "i2c.h"
+
+template<unsigned NUM_REGS, typename TVALUE = uint8_t>
+class I2CShadow
+{
+public:
+    I2CShadow(I2C &bus,
+              uint8_t slave,
+              I2C::Addressing addressing = I2C::ADDRESS_8BIT,
+              I2C::ByteOrder order = I2C::VALUE_BE,
+              uint16_t base = 0) :
+        _bus(bus),
+        _slave(slave),
+        _addressing(addressing),
+        _order(order),
+        _base(base)
+    {}
+
+    // Mark a register as volatile; it will never be cached.
+    void                set_volatile(unsigned reg, bool is_volatile = true)
+    {
+        set_bit(_volatile, reg, is_volatile);
+        set_bit(_valid, reg, false);
+        set_bit(_dirty, reg, false);
+    }
+
+    // Forget everything we know about the device's registers, e.g. after
+    // the device has been reset. Unflushed writes are lost.
+    void                invalidate()
+    {
+        for (auto i = 0U; i < MAP_WORDS; i++) {
+            _valid[i] = 0;
+            _dirty[i] = 0;
+        }
+    }
+
+    // Populate the cache for a range of registers with a single burst read.
+    I2C::State          load(unsigned first = 0, unsigned count = NUM_REGS)
+    {
+        while (count > 0) {
+            auto n = (count < MAX_BURST) ? count : MAX_BURST;
+            auto result = _bus.readRegisters(_slave, _base + first, &_regs[first], n, _addressing, _order);
+
+            if (result != I2C::ACK) {
+                return result;
+            }
+
+            for (auto reg = first; reg < (first + n); reg++) {
+                if (!get_bit(_volatile, reg)) {
+                    set_bit(_valid, reg, true);
+                }
+            }
+
+            first += n;
+            count -= n;
+        }
+
+        return I2C::ACK;
+    }
+
+    // Read a register, from the cache if possible.
+    I2C::State          read(unsigned reg, TVALUE &value)
+    {
+        if (!get_bit(_valid, reg)) {
+            auto result = _bus.readRegister<TVALUE>(_slave, _base + reg, _regs[reg], _addressing, _order);
+
+            if (result != I2C::ACK) {
+                return result;
+            }
+
+            if (!get_bit(_volatile, reg)) {
+                set_bit(_valid, reg, true);
+            }
+        }
+
+        value = _regs[reg];
+        return I2C::ACK;
+    }
+
+    // Write a register. Volatile registers are written immediately; others
+    // are updated in the cache and written by flush() if they changed.
+    I2C::State          write(unsigned reg, TVALUE value)
+    {
+        if (get_bit(_volatile, reg)) {
+            return _bus.writeRegister<TVALUE>(_slave, _base + reg, value, _addressing, _order);
+        }
+
+        if (!get_bit(_valid, reg) || (_regs[reg] != value)) {
+            _regs[reg] = value;
+            set_bit(_valid, reg, true);
+            set_bit(_dirty, reg, true);
+        }
+
+        return I2C::ACK;
+    }
+
+    // Read-modify-write the bits in mask; only reads the device if the
+    // register is not already cached.
+    I2C::State          modify(unsigned reg, TVALUE mask, TVALUE bits)
+    {
+        TVALUE value;
+        auto result = read(reg, value);
+
+        if (result != I2C::ACK) {
+            return result;
+        }
+
+        return write(reg, (value & ~mask) | (bits & mask));
+    }
+
+    // Write all dirty registers to the device, coalescing neighbours into
+    // bursts. Short runs of clean registers between dirty ones are written
+    // again rather than starting a new transfer.
+    I2C::State          flush()
+    {
+        unsigned reg = 0;
+
+        while (reg < NUM_REGS) {
+            if (!get_bit(_dirty, reg)) {
+                reg++;
+                continue;
+            }
+
+            // extend the run over dirty registers and small clean gaps
+            auto first = reg;
+            auto last = reg;
+
+            for (auto next = reg + 1; (next < NUM_REGS) && ((next - first) < MAX_BURST); next++) {
+                if (get_bit(_dirty, next)) {
+                    last = next;
+                } else if (!get_bit(_valid, next) || ((next - last) > MAX_GAP)) {
+                    break;
+                }
+            }
+
+            auto count = last - first + 1;
+            auto result = _bus.writeRegisters(_slave, _base + first, &_regs[first], count, _addressing, _order);
+
+            if (result != I2C::ACK) {
+                return result;
+            }
+
+            for (reg = first; reg <= last; reg++) {
+                set_bit(_dirty, reg, false);
+            }
+        }
+
+        return I2C::ACK;
+    }
+
+    bool                dirty() const
+    {
+        for (auto i = 0U; i < MAP_WORDS; i++) {
+            if (_dirty[i] != 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    static const unsigned   MAP_WORDS = (NUM_REGS + 31) / 32;
+    static const unsigned   MAX_BURST = 255 / sizeof(TVALUE);
+    static const unsigned   MAX_GAP = 2;
+
+    I2C                     &_bus;
+    const uint8_t           _slave;
+    const I2C::Addressing   _addressing;
+    const I2C::ByteOrder    _order;
+    const uint16_t          _base;
+
+    TVALUE                  _regs[NUM_REGS] = {};
+    uint32_t                _valid[MAP_WORDS] = {};
+    uint32_t                _dirty[MAP_WORDS] = {};
+    uint32_t                _volatile[MAP_WORDS] = {};
+
+    static bool             get_bit(const uint32_t *map, unsigned reg)
+    {
+        return map[reg / 32] & (1U << (reg % 32));
+    }
+
+    static void             set_bit(uint32_t *map, unsigned reg, bool value)
+    {
+        if (value) {
+            map[reg / 32] |= (1U << (reg % 32));
+        } else {
+            map[reg / 32] &= ~(1U << (reg % 32));
+        }
+    }
+};
@@ -40,6 +40,8 @@ public:
     __always_inline void                enable()  const { __atomic_thread_fence(__ATOMIC_RELEASE); NVIC_EnableIRQ(_vector); }
     __always_inline void                disable() const { NVIC_DisableIRQ(_vector); }
     __always_inline void                set_priority(unsigned priority) const { NVIC_SetPriority(_vector, priority); }
+    __always_inline void                clear_pending() const { NVIC_ClearPendingIRQ(_vector); }
+    __always_inline void                set_pending() const { NVIC_SetPendingIRQ(_vector); }
 
     __always_inline static void         enable_all() { __atomic_thread_fence(__ATOMIC_RELEASE); __enable_irq(); }
     __always_inline static void         disable_all() { __disable_irq(); __atomic_thread_fence(__ATOMIC_ACQUIRE); }
@@ -178,10 +178,10 @@ public:
 
 #define P0_3                Gpio(0, 3, &LPC_IOCON->PIO0_3, 0)
 
-#define P0_4                Gpio(0, 4, &LPC_IOCON->PIO0_4, 0 | Pin::I2CModeNone)
+#define P0_4                Gpio(0, 4, &LPC_IOCON->PIO0_4, 0 | Pin::I2CNone)
 #define P0_4_SCL            Pin(&LPC_IOCON->PIO0_4, 1)
 
-#define P0_5                Gpio(0, 5, &LPC_IOCON->PIO0_5, 0 | Pin::I2CModeNone)
+#define P0_5                Gpio(0, 5, &LPC_IOCON->PIO0_5, 0 | Pin::I2CNone)
 #define P0_5_SDA            Pin(&LPC_IOCON->PIO0_5, 1)
 
 #define P0_6                Gpio(0, 6, &LPC_IOCON->PIO0_6, 0)
@@ -207,17 +207,17 @@ public:
 #define P0_11_AD0           Pin(&LPC_IOCON->R_PIO0_11, 2 | Pin::Analog)
 #define P0_11_CT32B0_MAT3   Pin(&LPC_IOCON->R_PIO0_11, 3 | Pin::Digital)
 
-#define P1_0                Gpio(1, 0, &LPC_IOCON->PIO1_0, 1 | Pin::Digital)
-#define P1_0_AD1            Pin(&LPC_IOCON->PIO1_0, 2 | Pin::Analog)
-#define P1_0_CT32B1_CAP0    Pin(&LPC_IOCON->PIO1_0, 3 | Pin::Digital)
+#define P1_0                Gpio(1, 0, &LPC_IOCON->R_PIO1_0, 1 | Pin::Digital)
+#define P1_0_AD1            Pin(&LPC_IOCON->R_PIO1_0, 2 | Pin::Analog)
+#define P1_0_CT32B1_CAP0    Pin(&LPC_IOCON->R_PIO1_0, 3 | Pin::Digital)
 
-#define P1_1                Gpio(1, 1, &LPC_IOCON->PIO1_1, 1 | Pin::Digital)
-#define P1_1_AD2            Pin(&LPC_IOCON->PIO1_1, 2 | Pin::Analog)
-#define P1_1_CT32B1_MAT0    Pin(&LPC_IOCON->PIO1_1, 3 | Pin::Digital)
+#define P1_1                Gpio(1, 1, &LPC_IOCON->R_PIO1_1, 1 | Pin::Digital)
+#define P1_1_AD2            Pin(&LPC_IOCON->R_PIO1_1, 2 | Pin::Analog)
+#define P1_1_CT32B1_MAT0    Pin(&LPC_IOCON->R_PIO1_1, 3 | Pin::Digital)
 
-#define P1_2                Gpio(1, 2, &LPC_IOCON->PIO1_2, 1 | Pin::Digital)
-#define P1_2_AD3            Pin(&LPC_IOCON->PIO1_2, 2 | Pin::Analog)
-#define P1_2_CT32B1_MAT1    Pin(&LPC_IOCON->PIO1_2, 3 | Pin::Digital)
+#define P1_2                Gpio(1, 2, &LPC_IOCON->R_PIO1_2, 1 | Pin::Digital)
+#define P1_2_AD3            Pin(&LPC_IOCON->R_PIO1_2, 2 | Pin::Analog)
+#define P1_2_CT32B1_MAT1    Pin(&LPC_IOCON->R_PIO1_2, 3 | Pin::Digital)
 
 #define P1_3                Gpio(1, 3, &LPC_IOCON->SWDIO_PIO1_3, 1 | Pin::Digital)
 #define P1_3_SWDIO          Pin(&LPC_IOCON->SWDIO_PIO1_3, 0 | Pin::Digital)
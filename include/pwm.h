@@ -0,0 +1,117 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+// Edge-aligned PWM on up to three match outputs of a timer.
+//
+// MR3 sets the period; MR0-2 set the point in each period at which the
+// corresponding MAT output goes high. The match registers are not
+// buffered, so a new value is written from an interrupt at a point where
+// it can't cut the current period short: just after the channel's output
+// has gone high (it then stays high until the period ends whatever the
+// new value), or at the start of the period for a channel that is low
+// throughout. The new value takes effect in the following period, or in
+// the current one if it is still ahead of the count. This costs one
+// interrupt per update rather than per edge.
+//
+// A channel whose high time is shorter than the interrupt latency may see
+// its update deferred by a period or more, but never a truncated or
+// doubled pulse.
+//
+// The MAT pins must be configured separately.
+
+#include "timer.h"
+
+class PWM : public Timer
+{
+public:
+    constexpr PWM(unsigned index) :
+        Timer(index)
+    {}
+
+    // Prescaler and period for a frequency.
+    struct Config {
+        uint32_t    prescale;       // PR + 1
+        uint32_t    period;         // MR3 + 1
+    };
+
+    // Finest resolution (longest period in ticks) that fits the timer
+    // and gives the requested frequency. Frequencies are clamped to
+    // 1Hz - PCLK / 2, the latter giving a two-tick period.
+    static constexpr Config config_for(unsigned frequency, bool wide)
+    {
+        uint32_t limit = wide ? 0xffffffff : 0x10000;
+        uint32_t cycles = (frequency == 0) ? Syscon::PCLK_FREQ :
+                          (frequency >= (Syscon::PCLK_FREQ / 2)) ? 2 :
+                          Syscon::PCLK_FREQ / frequency;
+        uint32_t prescale = (cycles > 0) ? ((cycles - 1) / limit + 1) : 1;
+
+        return { prescale, cycles / prescale };
+    }
+
+    static constexpr unsigned frequency_for(const Config &config)
+    {
+        return Syscon::PCLK_FREQ / (config.prescale * config.period);
+    }
+
+    // Start the timer with all channels in channels (bitmask of 0-2) low.
+    // A config with a zero prescale or a period of less than two ticks is
+    // ignored.
+    void                configure(const Config &config, unsigned channels);
+    void                configure(unsigned frequency, unsigned channels)
+    {
+        configure(config_for(frequency, _index >= 2), channels);
+    }
+
+    // Period in timer ticks.
+    uint32_t            period() const { return _regs.MR3 + 1; }
+
+    // Set the high time of a channel in timer ticks, from 0 (always low)
+    // to period() (always high), taking effect at the start of a period.
+    void                set_width(unsigned channel, uint32_t width);
+
+    // Set the duty cycle as a fraction of 65536.
+    void                set_duty(unsigned channel, uint16_t duty)
+    {
+        set_width(channel, ((uint64_t)period() * duty) >> 16);
+    }
+
+private:
+    struct Pending {
+        uint32_t            match[3];
+        unsigned            mask;
+    };
+    static Pending      _pending[4];
+
+    // ticks of margin needed to be sure a match value is still ahead of
+    // the count when it is written
+    static const uint32_t GUARD_TICKS = 16;
+
+    static void         edge(unsigned index, Channel channel, void *context);
+    static void         restart(unsigned index, Channel channel, void *context);
+};
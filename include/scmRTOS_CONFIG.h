@@ -6,6 +6,12 @@
 #include <stdint.h>
 typedef uint16_t      timeout_t;
 typedef uint_fast32_t tick_count_t;
+
+#ifdef __cplusplus
+// Set by main() just before OS::run(); until then nothing can block on an
+// OS object, e.g. in board_init().
+extern volatile bool os_started;
+#endif
 #endif // __ASSEMBLER__
 
 // Options that can be overridden by the client at build time.
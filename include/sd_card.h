@@ -0,0 +1,126 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+// SD / SDHC / SDXC card in SPI mode.
+//
+// The card is brought up at 400kHz and switched to the requested rate
+// once initialised. Transfers of more than one block use the multi-block
+// commands (CMD18 / CMD25), streaming data without a command and response
+// per block.
+//
+// With CONFIG_SD_CRC enabled, CRC checking is turned on in the card
+// (CMD59) and data block CRCs are verified on read; otherwise only the
+// commands that require a valid CRC during initialisation get one.
+
+#include "config.h"
+#include "spi_device.h"
+
+class SdCard
+{
+public:
+    enum Status {
+        OK,
+        ERROR,
+        TIMEOUT,
+        CRC_ERROR,
+        NO_CARD,
+    };
+
+    static const uint32_t   BLOCK_SIZE = 512;
+
+    constexpr SdCard(unsigned ssp, Gpio cs, unsigned rate = 12000000) :
+        _slow(ssp, cs, 400000, 8, 0),
+        _fast(ssp, cs, rate, 8, 0)
+    {}
+
+    // Detect and initialise the card.
+    Status              init();
+
+    // Read / write count blocks starting at block.
+    Status              read(uint32_t block, uint8_t *buffer, uint32_t count);
+    Status              write(uint32_t block, const uint8_t *buffer, uint32_t count);
+
+    uint32_t            blocks() const { return _blocks; }
+    bool                high_capacity() const { return _highCapacity; }
+
+private:
+    enum Command : uint8_t {
+        CMD0_GO_IDLE_STATE          = 0,
+        CMD8_SEND_IF_COND           = 8,
+        CMD9_SEND_CSD               = 9,
+        CMD12_STOP_TRANSMISSION     = 12,
+        CMD16_SET_BLOCKLEN          = 16,
+        CMD17_READ_SINGLE_BLOCK     = 17,
+        CMD18_READ_MULTIPLE_BLOCK   = 18,
+        CMD24_WRITE_BLOCK           = 24,
+        CMD25_WRITE_MULTIPLE_BLOCK  = 25,
+        CMD55_APP_CMD               = 55,
+        CMD58_READ_OCR              = 58,
+        CMD59_CRC_ON_OFF            = 59,
+        ACMD41_SD_SEND_OP_COND      = 41,
+    };
+
+    enum R1 : uint8_t {
+        R1_IDLE                     = 0x01,
+        R1_ILLEGAL_COMMAND          = 0x04,
+        R1_CRC_ERROR                = 0x08,
+        R1_INVALID                  = 0x80,
+    };
+
+    enum Token : uint8_t {
+        TOKEN_START_BLOCK           = 0xfe,
+        TOKEN_START_MULTIPLE        = 0xfc,
+        TOKEN_STOP_TRANSMISSION     = 0xfd,
+        DATA_RESPONSE_MASK          = 0x1f,
+        DATA_RESPONSE_ACCEPTED      = 0x05,
+        DATA_RESPONSE_CRC_ERROR     = 0x0b,
+    };
+
+    static const uint32_t   OCR_CCS = 0x40000000;
+    static const uint32_t   ACMD41_HCS = 0x40000000;
+
+    SpiDevice           _slow;
+    SpiDevice           _fast;
+    bool                _initialised = false;
+    bool                _highCapacity = false;
+    uint32_t            _blocks = 0;
+
+    uint8_t             command(SSP &ssp, Command cmd, uint32_t arg);
+    uint8_t             app_command(SSP &ssp, Command cmd, uint32_t arg);
+    Status              wait_ready(SSP &ssp, uint32_t timeout);
+    Status              read_data(SSP &ssp, uint8_t *buffer, uint32_t length);
+    Status              write_data(SSP &ssp, uint8_t token, const uint8_t *buffer);
+    Status              identify(SSP &ssp);
+    Status              read_csd();
+    void                finish(const SpiDevice &device, SSP &ssp);
+    uint32_t            address(uint32_t block) const { return _highCapacity ? block : (block * BLOCK_SIZE); }
+
+    static uint8_t      crc7(const uint8_t *buffer, unsigned length);
+    static uint16_t     crc16(const uint8_t *buffer, unsigned length);
+};
@@ -0,0 +1,108 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+// Shift-register I/O expansion (74HC595 / TPIC6B595 outputs, 74HC165
+// inputs) refreshed periodically in the background.
+//
+// A hardware timer starts each refresh, which shifts the output image out
+// and the input image in with a single interrupt-driven full-duplex
+// transfer, then pulses the latch. The latch rising edge transfers the
+// new outputs to the 595 output registers; while it is low the 165s load
+// their inputs, ready to be shifted in by the next refresh, so inputs are
+// always one refresh interval old.
+//
+// The application's images are copied to / from the transfer buffers in
+// interrupt context at the start and end of each refresh, so neither side
+// ever sees a partially updated image. Byte 0 is the first byte shifted.
+//
+// The SSP port may be shared with SpiDevices. Each refresh reconfigures the
+// port for the chain, and is skipped (and counted as an overrun) if a
+// device transaction holds the port when it is due.
+
+#include "config.h"
+#include "pin.h"
+#include "ssp.h"
+#include "timer.h"
+
+class ShiftChain
+{
+public:
+    constexpr ShiftChain(unsigned ssp,
+                         unsigned timer,
+                         Gpio latch,
+                         unsigned rate,
+                         unsigned length,
+                         unsigned mode = 0) :
+        _ssp(ssp),
+        _timer(timer),
+        _latch(latch),
+        _config(SSP::config_for(rate, 8, mode)),
+        _length((length < CONFIG_SHIFT_CHAIN_MAX_BYTES) ? length : CONFIG_SHIFT_CHAIN_MAX_BYTES)
+    {}
+
+    // Start refreshing every interval microseconds; callback is called
+    // from interrupt context after each refresh completes. Returns false
+    // if the timer is the one used by the Timebase.
+    bool                start(uint32_t interval, SSP::Callback callback = nullptr);
+    void                stop();
+
+    // Set the image to be shifted out by the next refresh.
+    void                write(const uint8_t *image);
+
+    // Copy the most recently shifted-in image; returns the number of
+    // refreshes completed so far, which can be used to spot new data.
+    unsigned            read(uint8_t *image);
+
+    // Refreshes skipped because the previous one had not finished or the
+    // port was in use.
+    unsigned            overruns() const { return _overruns; }
+
+private:
+    const unsigned      _ssp;
+    const unsigned      _timer;
+    Gpio                _latch;
+    const SSP::Config   _config;
+    const unsigned      _length;
+    SSP::Callback       _callback = nullptr;
+
+    uint8_t             _pending[CONFIG_SHIFT_CHAIN_MAX_BYTES] = {};
+    uint8_t             _tx[CONFIG_SHIFT_CHAIN_MAX_BYTES] = {};
+    uint8_t             _rx[CONFIG_SHIFT_CHAIN_MAX_BYTES] = {};
+    uint8_t             _in[CONFIG_SHIFT_CHAIN_MAX_BYTES] = {};
+    volatile unsigned   _sequence = 0;
+    volatile unsigned   _overruns = 0;
+
+    static ShiftChain   *_chains[2];        // by SSP
+
+    void                refresh();
+    void                complete();
+
+    static void         tick(unsigned index, Timer::Channel channel, void *context) { (void)index; (void)channel; static_cast<ShiftChain *>(context)->refresh(); }
+    static void         done(unsigned index) { _chains[index]->complete(); }
+};
@@ -0,0 +1,102 @@
+// Copyright (c) 2018 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+// An SPI device on one of the SSP ports.
+//
+// Binds a chip-select GPIO to a precomputed bus configuration (including
+// clock divisors, solved at compile time for constant rates), so that
+// switching between devices with different modes and rates on a shared
+// bus costs at most a couple of register writes.
+
+#include "pin.h"
+#include "ssp.h"
+
+class SpiDevice
+{
+public:
+    constexpr SpiDevice(unsigned ssp,
+                        Gpio cs,
+                        unsigned rate,
+                        unsigned nbits,
+                        unsigned mode,
+                        SSP::Format format = SSP::FORMAT_SPI) :
+        _ssp(ssp),
+        _cs(cs),
+        _config(SSP::config_for(rate, nbits, mode, format))
+    {}
+
+    // Set up the chip-select; call once before use.
+    void        init()
+    {
+        _cs.set();
+        _cs.configure(Gpio::Output, Pin::PushPull);
+    }
+
+    // Start a transaction; take the bus, switch it to our configuration
+    // and assert chip-select.
+    SSP         begin() const
+    {
+        SSP(_ssp).acquire();
+        auto ssp = SSP(_ssp).apply(_config);
+        _cs.clear();
+        return ssp;
+    }
+
+    // Wait for the last frame and release chip-select, but keep the bus,
+    // e.g. to send clocks with the device deselected.
+    void        deselect() const
+    {
+        SSP(_ssp).flush();
+        _cs.set();
+    }
+
+    // End a transaction; release chip-select and the bus.
+    void        end() const
+    {
+        deselect();
+        SSP(_ssp).release();
+    }
+
+    // Single-shot transactions.
+    void        transfer(const uint8_t *source, uint8_t *destination, unsigned count) const
+    {
+        begin().transfer(source, destination, count);
+        end();
+    }
+
+    void        transfer(const uint16_t *source, uint16_t *destination, unsigned count) const
+    {
+        begin().transfer(source, destination, count);
+        end();
+    }
+
+private:
+    const unsigned  _ssp;
+    Gpio            _cs;
+    const SSP::Config _config;
+};
@@ -0,0 +1,126 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+// ST7735 / ILI9341-style SPI TFT displays.
+//
+// There isn't RAM for a framebuffer, so the application describes what
+// has changed with invalidate(), and update() asks a renderer to draw
+// each changed region a span at a time into a small line buffer, which is
+// sent with the display's column/row window set to the region.
+//
+// Commands go out as 8-bit frames; pixels go out as 16-bit frames, which
+// halves the number of FIFO operations and means RGB565 values can be
+// sent as-is (MSB first) without byte swapping.
+//
+// Overlapping or touching dirty rectangles are merged; once the table is
+// full, a new rectangle is merged with whichever existing one grows the
+// least, so some unchanged pixels may be redrawn.
+
+#include "config.h"
+#include "pin.h"
+#include "spi_device.h"
+
+class SpiDisplay
+{
+public:
+    // Render count pixels of row y starting at column x into pixels.
+    typedef void (* Renderer)(void *context, unsigned x, unsigned y, unsigned count, uint16_t *pixels);
+
+    constexpr SpiDisplay(unsigned ssp,
+                         Gpio cs,
+                         Gpio dc,
+                         unsigned rate,
+                         uint16_t width,
+                         uint16_t height,
+                         uint16_t xoffset = 0,
+                         uint16_t yoffset = 0) :
+        _command(ssp, cs, rate, 8, 0),
+        _pixels(ssp, cs, rate, 16, 0),
+        _dc(dc),
+        _width(width),
+        _height(height),
+        _xoffset(xoffset),
+        _yoffset(yoffset)
+    {}
+
+    // Reset the controller and set it up for RGB565 with the given
+    // memory access control (rotation / mirroring / BGR) setting. Panel
+    // specific tuning can be sent afterwards with command().
+    void                init(uint8_t madctl = 0);
+
+    // Send a command with optional parameters.
+    void                command(uint8_t cmd, const uint8_t *params = nullptr, unsigned length = 0);
+
+    // Mark a region as needing to be redrawn.
+    void                invalidate(unsigned x, unsigned y, unsigned width, unsigned height);
+    void                invalidate() { invalidate(0, 0, _width, _height); }
+    bool                dirty() const { return _numDirty > 0; }
+
+    // Redraw all dirty regions.
+    void                update(Renderer renderer, void *context);
+
+    uint16_t            width() const { return _width; }
+    uint16_t            height() const { return _height; }
+
+private:
+    enum Command : uint8_t {
+        CMD_SWRESET         = 0x01,
+        CMD_SLPOUT          = 0x11,
+        CMD_DISPON          = 0x29,
+        CMD_CASET           = 0x2a,
+        CMD_RASET           = 0x2b,
+        CMD_RAMWR           = 0x2c,
+        CMD_MADCTL          = 0x36,
+        CMD_COLMOD          = 0x3a,
+    };
+
+    static const uint8_t    COLMOD_RGB565 = 0x55;
+
+    struct Rect {
+        uint16_t            x0, y0;         // inclusive
+        uint16_t            x1, y1;         // exclusive
+        unsigned            area() const { return (unsigned)(x1 - x0) * (y1 - y0); }
+    };
+
+    SpiDevice           _command;
+    SpiDevice           _pixels;
+    Gpio                _dc;
+    const uint16_t      _width;
+    const uint16_t      _height;
+    const uint16_t      _xoffset;
+    const uint16_t      _yoffset;
+
+    Rect                _dirty[CONFIG_DISPLAY_DIRTY_RECTS] = {};
+    unsigned            _numDirty = 0;
+    uint16_t            _line[CONFIG_DISPLAY_LINE_PIXELS] = {};
+
+    void                draw(const Rect &rect, Renderer renderer, void *context);
+    static Rect         merge(const Rect &a, const Rect &b);
+    static void         delay(unsigned us);
+};
@@ -0,0 +1,113 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+// W25Qxx-style SPI NOR flash.
+//
+// Parts with 24-bit addressing (up to 16MiB) are supported; the size is
+// taken from the JEDEC ID by probe(). Program and erase operations return
+// as soon as the command has been issued, and the next operation waits
+// for the device to become ready.
+//
+// Reads no larger than the cache go through a small read-ahead cache, so
+// that repeated small reads of nearby data cost only a memcpy. Larger
+// reads are streamed directly with fast read.
+
+#include "config.h"
+#include "spi_device.h"
+
+class SpiFlash
+{
+public:
+    enum Status {
+        OK,
+        ERROR,
+        TIMEOUT,
+    };
+
+    static const uint32_t   PAGE_SIZE = 256;
+    static const uint32_t   SECTOR_SIZE = 4096;
+
+    constexpr SpiFlash(SpiDevice &device) :
+        _device(device)
+    {}
+
+    // Read the JEDEC ID and work out the device size; must be called
+    // before any other operation.
+    Status              probe();
+
+    // Read length bytes starting at address.
+    Status              read(uint32_t address, uint8_t *buffer, uint32_t length);
+
+    // Program length bytes starting at address, split at page boundaries.
+    // The region must have been erased.
+    Status              write(uint32_t address, const uint8_t *buffer, uint32_t length);
+
+    // Erase the sectors covering length bytes starting at address; both
+    // must be sector-aligned.
+    Status              erase(uint32_t address, uint32_t length);
+
+    // Wait for any outstanding program or erase to complete.
+    Status              sync();
+
+    // Forget cached data, e.g. if the device has been written by someone else.
+    void                invalidate() { _cacheLength = 0; }
+
+    uint32_t            jedec_id() const { return _jedecId; }
+    uint32_t            size() const { return _size; }
+
+private:
+    enum Command : uint8_t {
+        CMD_WRITE_ENABLE    = 0x06,
+        CMD_READ_STATUS     = 0x05,
+        CMD_PAGE_PROGRAM    = 0x02,
+        CMD_FAST_READ       = 0x0b,
+        CMD_SECTOR_ERASE    = 0x20,
+        CMD_READ_JEDEC_ID   = 0x9f,
+    };
+
+    enum StatusBits : uint8_t {
+        STATUS_WIP          = 0x01,
+        STATUS_WEL          = 0x02,
+    };
+
+    SpiDevice           &_device;
+    uint32_t            _jedecId = 0;
+    uint32_t            _size = 0;
+    bool                _busy = false;
+    uint64_t            _busyDeadline = 0;
+
+    uint8_t             _cache[CONFIG_SPI_FLASH_CACHE_SIZE] = {};
+    uint32_t            _cacheAddress = 0;
+    uint32_t            _cacheLength = 0;
+
+    void                fast_read(uint32_t address, uint8_t *buffer, uint32_t length);
+    void                write_command(Command cmd, uint32_t address, const uint8_t *buffer, uint32_t length);
+    void                invalidate(uint32_t address, uint32_t length);
+    void                set_busy(uint32_t timeout);
+};
@@ -27,23 +27,245 @@
 #pragma once
 
 #include <LPC11xx.h>
+#include "interrupt.h"
 #include "syscon.h"
 
 class SSP
 {
 public:
+    typedef void (* Callback)(unsigned index);
+
+    // Frame formats. mode (CPOL/CPHA) only applies to SPI; TI frames are
+    // marked by a one-clock SSEL pulse before each word, and Microwire
+    // sends an 8-bit control word and then receives an nbits data word.
+    enum Format {
+        FORMAT_SPI,
+        FORMAT_TI,
+        FORMAT_MICROWIRE,
+    };
+
     constexpr SSP(unsigned index) :
+        _index(index),
         _reg((index == 0) ? * LPC_SSP0 : * LPC_SSP1),
-        _syscon((index == 0) ? SYSCON_SSP0 : SYSCON_SSP1)
+        _syscon((index == 0) ? SYSCON_SSP0 : SYSCON_SSP1),
+        _irq((index == 0) ? SSP0_IRQ : SSP1_IRQ)
     {}
 
-    SSP         &configure(unsigned rate, unsigned nbits, unsigned mode);
-    void        transfer(uint8_t *source, uint8_t *destination, unsigned count);
-    void        transfer(uint16_t *source, uint16_t *destination, unsigned count);
+    SSP         &configure(unsigned rate, unsigned nbits, unsigned mode, Format format = FORMAT_SPI);
+
+    // Clock divisors; the bit rate is PCLK / (prescale * cpsdvsr * (scr + 1)).
+    struct Divisors {
+        uint8_t     prescale;       // SSPnCLKDIV, 1-255
+        uint8_t     cpsdvsr;        // CPSR, even 2-254
+        uint8_t     scr;            // CR0.SCR, 0-255
+    };
+
+    // Find divisors giving close to the fastest rate that does not exceed
+    // the requested rate. Only the two smallest prescalers that can reach
+    // the rate are tried, and for each even CPSDVSR the SCR is computed
+    // directly, so the search is bounded at ~250 steps. Above 200Hz the
+    // result is within 0.1% of the best possible, and always a little
+    // slower rather than faster.
+    static constexpr Divisors divisors_for(unsigned rate)
+    {
+        // smallest total divisor that doesn't exceed the rate; the product
+        // is always even, so that is the best we can hope for
+        unsigned target = (rate >= (Syscon::PCLK_FREQ / 2)) ? 2 :
+                          (rate == 0) ? 255U * 254U * 256U :
+                          ((Syscon::PCLK_FREQ + rate - 1) / rate);
+        unsigned ideal = (target + 1) & ~1U;
+        unsigned first = (target + (254U * 256U) - 1) / (254U * 256U);
+        Divisors best = { 255, 254, 255 };
+        unsigned best_divisor = 255U * 254U * 256U;
+
+        for (unsigned prescale = (first > 0) ? first : 1;
+             (prescale <= 255) && (prescale <= (first + 1));
+             prescale++) {
+            // cpsdvsr * (scr + 1) must reach this, with scr + 1 <= 256
+            auto want = (target + prescale - 1) / prescale;
+            auto cpsdvsr = (want + 255) / 256;
+
+            cpsdvsr += cpsdvsr & 1;
+
+            for (cpsdvsr = (cpsdvsr < 2) ? 2 : cpsdvsr; cpsdvsr <= 254; cpsdvsr += 2) {
+                auto scr1 = (want + cpsdvsr - 1) / cpsdvsr;
+                auto divisor = prescale * cpsdvsr * scr1;
+
+                if (divisor < best_divisor) {
+                    best = { (uint8_t)prescale, (uint8_t)cpsdvsr, (uint8_t)(scr1 - 1) };
+                    best_divisor = divisor;
+
+                    if (best_divisor == ideal) {
+                        return best;
+                    }
+                }
+
+                // larger CPSDVSRs can only overshoot further
+                if (scr1 == 1) {
+                    break;
+                }
+            }
+        }
+
+        return best;
+    }
+
+    static constexpr unsigned rate_for(const Divisors &divisors)
+    {
+        return Syscon::PCLK_FREQ / (divisors.prescale * divisors.cpsdvsr * (divisors.scr + 1U));
+    }
+
+    // Register values for a bus configuration.
+    struct Config {
+        uint32_t    cr0;
+        uint8_t     cpsr;
+        uint8_t     prescale;
+    };
+
+    static constexpr Config config_for(unsigned rate, unsigned nbits, unsigned mode, Format format = FORMAT_SPI)
+    {
+        auto divisors = divisors_for(rate);
+
+        return {
+            ((CR0_DSS_4BIT + (nbits - 4)) |
+             ((format == FORMAT_TI) ? CR0_FRF_TI :
+              (format == FORMAT_MICROWIRE) ? CR0_FRF_MWIRE :
+              (mode == 0) ? CR0_FRF_SPI | CR0_CPOL_LOW | CR0_CPHA_FIRST :
+              (mode == 1) ? CR0_FRF_SPI | CR0_CPOL_LOW | CR0_CPHA_SECOND :
+              (mode == 2) ? CR0_FRF_SPI | CR0_CPOL_HIGH | CR0_CPHA_FIRST : CR0_FRF_SPI | CR0_CPOL_HIGH | CR0_CPHA_SECOND) |
+             ((uint32_t)divisors.scr << 8)),
+            divisors.cpsdvsr,
+            divisors.prescale
+        };
+    }
+
+    // Switch to a configuration precomputed with config_for(), writing only
+    // the registers that differ from the current state. The block is fully
+    // initialised if it is not already running.
+    SSP         &apply(const Config &config);
+
+    // Wait for the last frame to finish on the wire.
+    void        flush() const { while (_reg.SR & SR_BSY_BUSY) {} }
+
+    // Full-duplex transfer of count frames. A null source sends the fill
+    // word (receive-only), a null destination discards what is received
+    // (transmit-only).
+    void        transfer(const uint8_t *source, uint8_t *destination, unsigned count);
+    void        transfer(const uint16_t *source, uint16_t *destination, unsigned count);
+
+    // Transmit-only; received data is thrown away once the transfer is done.
+    void        send(const uint8_t *source, unsigned count) { transfer(source, nullptr, count); }
+    void        send(const uint16_t *source, unsigned count) { transfer(source, nullptr, count); }
+
+    // Receive-only; the fill word is clocked out for each frame received.
+    void        receive(uint8_t *destination, unsigned count) { transfer((const uint8_t *)nullptr, destination, count); }
+    void        receive(uint16_t *destination, unsigned count) { transfer((const uint16_t *)nullptr, destination, count); }
+
+    // Microwire; each control word sent is answered by one data word. A
+    // null control sends the fill word, a null data discards responses.
+    // TI frames need nothing special and use transfer() and friends.
+    void        transfer_microwire(const uint8_t *control, uint16_t *data, unsigned count);
+
+    // Set the word sent by receive-only transfers (default 0xffff, truncated
+    // to the frame size; idle-high MOSI suits most SPI devices).
+    void        set_fill(uint16_t fill) { _fill[_index] = fill; }
+
+    // Interrupt-driven transfers; the FIFOs are serviced from the SSP
+    // interrupt and callback is called (from interrupt context) once the
+    // last frame has been received. Null source and destination behave
+    // as for transfer(). Returns false if a transfer is already in progress.
+    bool        transfer_async(const uint8_t *source, uint8_t *destination, unsigned count, Callback callback);
+    bool        transfer_async(const uint16_t *source, uint16_t *destination, unsigned count, Callback callback);
+    bool        busy() const { return _async[_index].rxresid > 0; }
+
+    // Ownership of a port shared between thread-level transactions and
+    // interrupt-driven users. Interrupt-driven users (e.g. ShiftChain)
+    // leave the port alone while it is held; acquire() waits for any
+    // asynchronous transfer to finish first. SpiDevice does this for its
+    // transactions.
+    void        acquire();
+    void        release() { _held[_index] = false; }
+    bool        held() const { return _held[_index]; }
+
+    // Slave mode.
+    //
+    // The host clocks fixed-length frames of length words. Received frames
+    // alternate between two buffers; callback is called from interrupt
+    // context with each completed buffer, which must be consumed before
+    // the other buffer fills. Each transmitted frame comes from the buffer
+    // most recently passed to slave_arm(); if none has been armed since the
+    // last frame started, the previous frame is sent again. Because the TX
+    // FIFO runs up to 8 words ahead, a buffer must be armed at least that
+    // long before the end of the current frame to be sent as the next one.
+    //
+    // If the receive FIFO overruns, words have been lost and frame alignment
+    // with the host is gone; the slave stops, the partial frame is dropped
+    // and callback is called with a null frame. slave_start() resumes, and
+    // must be called between frames.
+    //
+    // The SSP clock must be no faster than PCLK/12.
+    typedef void (* FrameCallback)(unsigned index, const void *frame);
+
+    SSP         &configure_slave(unsigned nbits, unsigned mode, Format format = FORMAT_SPI);
+    void        slave_start(const uint8_t *tx, uint8_t *rx0, uint8_t *rx1, unsigned length, FrameCallback callback);
+    void        slave_start(const uint16_t *tx, uint16_t *rx0, uint16_t *rx1, unsigned length, FrameCallback callback);
+    void        slave_arm(const void *tx) { _slave[_index].armed = static_cast<const uint8_t *>(tx); }
+    void        slave_stop();
+    unsigned    slave_overruns() const { return _slave[_index].overruns; }
 
 private:
+    friend void SSP0_Handler(void);
+    friend void SSP1_Handler(void);
+
+    static const unsigned   FIFO_DEPTH = 8;
+
+    struct Async {
+        const uint8_t       *source;
+        uint8_t             *destination;
+        unsigned            width;
+        unsigned            txresid;
+        volatile unsigned   rxresid;
+        Callback            callback;
+    };
+    static Async        _async[2];
+    static volatile bool _held[2];
+
+    struct Slave {
+        const uint8_t       *tx;                // frame being sent
+        const uint8_t       *volatile armed;    // next frame to send
+        unsigned            txIndex;
+        uint8_t             *rx[2];
+        unsigned            rxBuffer;
+        unsigned            rxIndex;
+        unsigned            length;             // in words, 0 if not running
+        FrameCallback       callback;
+        unsigned            overruns;
+    };
+    static Slave        _slave[2];
+    static uint16_t     _fill[2];
+
+    const unsigned      _index;
     LPC_SSP_TypeDef     &_reg;
     Syscon              _syscon;
+    Interrupt           _irq;
+
+    void                init(const Config &config);
+    volatile uint32_t   &prescaler() const { return (_index == 0) ? LPC_SYSCON->SSP0CLKDIV : LPC_SYSCON->SSP1CLKDIV; }
+    template<typename T>
+    void                transfer_sync(const T *source, T *destination, unsigned count);
+    template<typename T>
+    static void         burst_kernel(LPC_SSP_TypeDef &reg, const T *source, unsigned step, T *destination, unsigned count);
+    __attribute__((long_call))
+    static void         burst(LPC_SSP_TypeDef &reg, const uint8_t *source, unsigned step, uint8_t *destination, unsigned count);
+    __attribute__((long_call))
+    static void         burst(LPC_SSP_TypeDef &reg, const uint16_t *source, unsigned step, uint16_t *destination, unsigned count);
+    bool                start_async(const void *source, void *destination, unsigned count, unsigned width, Callback callback);
+    void                fill(Async &a);
+    void                drain(Async &a);
+    void                start_slave(const void *tx, void *rx0, void *rx1, unsigned length, FrameCallback callback);
+    template<typename T>
+    void                service_slave(Slave &sl);
+    void                interrupt();
 
     enum CR0 : uint32_t {
         CR0_DSS_MASK        = 0x0000000F, // Data size select
@@ -681,6 +681,13 @@ public:
         }
     }
 
+    // Clocked and out of reset, so that the block's registers can be used.
+    __always_inline bool running() const
+    {
+        return (LPC_SYSCON->SYSAHBCLKCTRL & _clock_bit)
+               && ((_reset_mask == 0) || (LPC_SYSCON->PRESETCTRL & _reset_mask));
+    }
+
     static void     init_48MHz();           // run CPU & fabric @ 48MHz
 
     static void     set_uart_prescale(unsigned idiv) { LPC_SYSCON->UARTCLKDIV = idiv; }
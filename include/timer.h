@@ -41,7 +41,20 @@ extern "C" void CT32_1_IRQHandler();
 class Timer
 {
 public:
-    typedef void (* Callback)(unsigned index);
+    // Interrupt sources; each can have its own callback, and all flagged
+    // sources are serviced in one pass of the interrupt handler, in this
+    // order.
+    enum Channel : unsigned {
+        CHANNEL_MR0,
+        CHANNEL_MR1,
+        CHANNEL_MR2,
+        CHANNEL_MR3,
+        CHANNEL_CR0,
+        NUM_CHANNELS
+    };
+
+    // Callbacks are told which timer and which of its channels fired.
+    typedef void (* Callback)(unsigned index, Channel channel, void *context);
 
     constexpr Timer(unsigned index) :
         _index(index),
@@ -68,18 +81,52 @@ public:
         _regs.EMR = 0;
         _regs.CTCR = 0;
         _regs.PWMC = 0;
-        _callbacks[_index] = nullptr;
+
+        for (auto &slot : _slots[_index]) {
+            slot = {};
+        }
+
+        _oneshot[_index] = 0;
+        _triggered[_index] = 0;
     }
 
     uint32_t            max_count() { return (_index < 2) ? 0xffff : 0xffffffff; }
 
+    // Set the callback for an interrupt source; enabling the interrupt
+    // itself (MCR / CCR) is up to the caller. A source that interrupts
+    // without a callback is disabled.
+    void                set_callback(Channel channel, Callback callback, void *context = nullptr);
+
+    // Run a channel's callback from the interrupt handler as though the
+    // channel had interrupted.
+    void                trigger(Channel channel);
+
+    // Call callback (from interrupt context) every interval microseconds;
+    // up to ~65ms on the 16-bit timers. Uses MR0.
+    void                periodic(uint32_t interval, Callback callback, void *context = nullptr);
+
+    // Free-running counter at PCLK / prescale, for timeout().
+    void                free_run(uint32_t prescale);
+
+    // Call callback once, ticks counts from now, using one of MR0-3, on a
+    // free-running timer; each match register is an independent timeout.
+    // ticks must be less than max_count().
+    void                timeout(Channel channel, uint32_t ticks, Callback callback, void *context = nullptr);
+    void                cancel_timeout(Channel channel);
+
 protected:
     friend void         TIMER_16_0_Handler(void);
     friend void         TIMER_16_1_Handler(void);
     friend void         TIMER_32_0_Handler(void);
     friend void         TIMER_32_1_Handler(void);
 
-    static Callback     _callbacks[4];
+    struct Slot {
+        Callback            callback;
+        void                *context;
+    };
+    static Slot         _slots[4][NUM_CHANNELS];
+    static uint8_t      _oneshot[4];        // channels to disable when they fire
+    static uint8_t      _triggered[4];      // channels triggered in software
 
     const unsigned      _index;
     LPC_TMR_TypeDef     &_regs;
@@ -216,17 +263,23 @@ protected:
         PWMC_PWM3_DISABLED          = 0x00000000,
     };
 
-    void                interrupt(void)
-    {
-        if (_callbacks[_index]) {
-            _callbacks[_index](_index);
-        } else {
-            cancel();
-        }
-    }
-
+    static uint32_t     match_interrupt(Channel channel) { return MCR_MR0_INT_MASK << (3 * channel); }
+    void                disable_channel(Channel channel);
+    void                interrupt(void);
 };
 
+// Free-running microsecond timebase.
+//
+// The timer interrupt publishes a snapshot of the extended time at least
+// every half counter period; readers combine the latest snapshot with the
+// hardware count without masking interrupts. Snapshots are double-buffered
+// so that a reader that interrupts the update still sees a consistent one,
+// and a reader that was itself interrupted by an update simply retries.
+//
+// Interrupts must not be held off for more than half a counter period
+// (~32ms with a 16-bit timer) or time will appear to go backwards, unless
+// time() / time32() are called at least that often while they are; with
+// PRIMASK set, a read does the interrupt's work itself.
 class _Timebase : public Timer
 {
 public:
@@ -239,10 +292,53 @@ public:
     void                configure();
     microseconds        time();
 
+    // Low 32 bits of time(), for intervals up to ~71 minutes; free on a
+    // 32-bit timer, and no 64-bit arithmetic on a 16-bit one.
+    uint32_t            time32();
+
+    // The raw counter, for very short intervals; wraps at max_count().
+    uint32_t            ticks() { return _regs.TC; }
+
+    // Call callback (from interrupt context) once time() reaches when,
+    // using MR2; replaces any alarm already set. An alarm in the past
+    // fires immediately.
+    void                set_alarm(microseconds when, Callback callback, void *context = nullptr);
+    void                cancel_alarm();
+
+    // For sleeping with interrupts masked: deal with a pending half-period
+    // interrupt in place. Returns true if nothing else (on this timer or
+    // anywhere else) is waiting for an interrupt, so that the caller can
+    // go back to sleep.
+    bool                absorb_wakeup();
+
 private:
-    static microseconds _time;
+    static microseconds _snapshot[2];
+    static volatile unsigned _sequence;
+    static microseconds _alarmTime;
+    static Callback     _alarmCallback;
+    static void         *_alarmContext;
 
-    static void         handler(unsigned index);
+    static void         handler(unsigned index, Channel channel, void *context);
+    static void         alarm(unsigned index, Channel channel, void *context);
+
+    void                service();
+    void                publish();
+    microseconds        extended();
+
+    __always_inline static microseconds snapshot()
+    {
+        unsigned sequence;
+        microseconds snap;
+
+        do {
+            sequence = _sequence;
+            __atomic_signal_fence(__ATOMIC_ACQUIRE);
+            snap = _snapshot[sequence & 1];
+            __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        } while (sequence != _sequence);
+
+        return snap;
+    }
 };
 
 #define Timebase        _Timebase(CONFIG_TIMEBASE_TIMER)
@@ -0,0 +1,202 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <capture.h>
+#include <interrupt.h>
+#include <pin.h>
+
+Capture::State  Capture::_state[4];
+
+void
+Capture::configure(unsigned cycles, unsigned prescale)
+{
+    cancel();
+
+    auto &s = _state[_index];
+    s = {};
+    s.cycles = (cycles > 0) ? cycles : 1;
+
+    _regs.CTCR = CTCR_CTMODE_TIMER;
+    _regs.PR = prescale - 1;
+
+    // interrupt as the counter wraps to zero, to extend it; a capture
+    // latched at max_count() is then always before the wrap. Start the
+    // count at 1 so that the match isn't taken at startup; timestamps are
+    // only ever used relative to each other.
+    _regs.MR0 = 0;
+    _regs.MCR = MCR_MR0_INT_ENABLED;
+    edge_select(true);
+    set_callback(CHANNEL_MR0, &Capture::wrap);
+    set_callback(CHANNEL_CR0, &Capture::edge);
+    _regs.TCR = TCR_COUNTERENABLE_DISABLED | TCR_COUNTERRESET_DISABLED;
+    _regs.TC = 1;
+    _regs.IR = IR_MASK_ALL;
+    _regs.TCR = TCR_COUNTERENABLE_ENABLED | TCR_COUNTERRESET_DISABLED;
+    _irq.enable();
+}
+
+bool
+Capture::measurement(Measurement &result)
+{
+    BEGIN_CRITICAL_SECTION;
+    result = _state[_index].result;
+    END_CRITICAL_SECTION;
+
+    return result.sequence > 0;
+}
+
+uint32_t
+Capture::frequency()
+{
+    Measurement m;
+
+    if (!measurement(m) || (m.period == 0)) {
+        return 0;
+    }
+
+    return (tick_rate() + (m.period / 2)) / m.period;
+}
+
+uint32_t
+Capture::period_us()
+{
+    Measurement m;
+
+    if (!measurement(m)) {
+        return 0;
+    }
+
+    return ((uint64_t)m.period * 1000000) / tick_rate();
+}
+
+uint32_t
+Capture::width_us()
+{
+    Measurement m;
+
+    if (!measurement(m)) {
+        return 0;
+    }
+
+    return ((uint64_t)m.width * 1000000) / tick_rate();
+}
+
+void
+Capture::edge_select(bool rising)
+{
+    _regs.CCR = (rising ? CCR_CAP0RE_ENABLED : CCR_CAP0FE_ENABLED) | CCR_CAP0I_ENABLED;
+}
+
+bool
+Capture::input()
+{
+    // GPIO data reads the pin level whatever function it is assigned to
+    switch (_index) {
+    case 0:
+        return (LPC_IOCON->CT16B0_CAP0_LOC & 1) ? P3_3.get() : P0_2.get();
+
+    case 1:
+        return P1_8.get();
+
+    case 2:
+        return (LPC_IOCON->CT32B0_CAP0_LOC & 1) ? P2_9.get() : P1_5.get();
+
+    default:
+        return P1_0.get();
+    }
+}
+
+void
+Capture::wrap(unsigned index, Channel channel, void *context)
+{
+    (void)channel;
+    (void)context;
+    _state[index].wraps++;
+}
+
+void
+Capture::edge(unsigned index, Channel channel, void *context)
+{
+    (void)channel;
+    (void)context;
+    auto capture = Capture(index);
+    auto &s = _state[index];
+    uint64_t range = (uint64_t)capture.max_count() + 1;
+    uint32_t count = capture._regs.CR0;
+    uint32_t now = capture._regs.TC;
+    uint64_t wraps = s.wraps;
+
+    // The wrap match is at zero and is serviced before the capture in the
+    // same pass, so a large count with the counter now below it was
+    // latched before a wrap that may already have been counted; it hasn't
+    // if the match is still pending. The counter is read first so that a
+    // wrap between the two reads is seen as pending.
+    if ((count >= (range / 2)) && (now < count) && !(capture._regs.IR & IR_MR0)) {
+        wraps--;
+    }
+
+    uint64_t timestamp = (wraps * range) + count;
+
+    // the captured edge is the one that was armed
+    bool rising = capture._regs.CCR & CCR_CAP0RE_MASK;
+
+    if (rising) {
+        if (s.started) {
+            s.sumPeriod += timestamp - s.lastRise;
+            s.sumWidth += s.lastFall - s.lastRise;
+
+            if (++s.count >= s.cycles) {
+                s.result.period = s.sumPeriod / s.count;
+                s.result.width = s.sumWidth / s.count;
+                s.result.sequence++;
+                s.count = 0;
+                s.sumPeriod = 0;
+                s.sumWidth = 0;
+            }
+        }
+
+        s.started = true;
+        s.lastRise = timestamp;
+    } else {
+        s.lastFall = timestamp;
+    }
+
+    capture.edge_select(!rising);
+
+    // If the input has already made the transition we have just armed for
+    // and it wasn't captured, it happened before the capture was armed.
+    // Pairing the next edge with this one would swap high and low times,
+    // so start again from the next rising edge.
+    if ((capture.input() != rising) && !(capture._regs.IR & IR_CR0)) {
+        s.started = false;
+        s.count = 0;
+        s.sumPeriod = 0;
+        s.sumWidth = 0;
+        s.result.missed++;
+        capture.edge_select(true);
+    }
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <counter.h>
+#include <interrupt.h>
+
+Counter::State  Counter::_state[4];
+
+void
+Counter::configure(Edge edge)
+{
+    cancel();
+    _state[_index] = {};
+
+    _regs.CTCR = ((edge == RISING) ? CTCR_CTMODE_COUNTERRISING :
+                  (edge == FALLING) ? CTCR_CTMODE_COUNTERFALLING : CTCR_CTMODE_COUNTERBOTH) |
+                 CTCR_CINPUTSELECT;
+    _regs.PR = 0;
+
+    // the counter only changes on an event, so a match on zero means it
+    // has just wrapped
+    _regs.MR0 = 0;
+    _regs.MCR = MCR_MR0_INT_ENABLED;
+    set_callback(CHANNEL_MR0, &Counter::wrap);
+    set_callback(CHANNEL_MR1, &Counter::match);
+    _regs.TCR = TCR_COUNTERENABLE_ENABLED | TCR_COUNTERRESET_DISABLED;
+
+    // the count starts out at zero, which matches MR0 without being a
+    // wrap; discard that before the interrupt can see it
+    _regs.IR = IR_MR0;
+    _irq.clear_pending();
+    _irq.enable();
+}
+
+uint64_t
+Counter::count()
+{
+    uint64_t range = (uint64_t)max_count() + 1;
+
+    BEGIN_CRITICAL_SECTION;
+
+    uint32_t count = _regs.TC;
+    uint64_t wraps = _state[_index].wraps;
+
+    // a wrap that hasn't been handled yet; the count may have been read
+    // either side of it
+    if ((_regs.IR & IR_MR0) && (count < (range / 2))) {
+        wraps++;
+    }
+
+    return (wraps * range) + count;
+
+    END_CRITICAL_SECTION;
+}
+
+void
+Counter::every(uint32_t events, Callback callback, void *context)
+{
+    BEGIN_CRITICAL_SECTION;
+
+    auto &s = _state[_index];
+    s.interval = events;
+    s.callback = callback;
+    s.context = context;
+
+    if ((events > 0) && (callback != nullptr)) {
+        s.next = count() + events;
+        set_match();
+    } else {
+        s.interval = 0;
+        _regs.MCR &= ~MCR_MR1_INT_MASK;
+    }
+
+    END_CRITICAL_SECTION;
+}
+
+void
+Counter::set_match()
+{
+    // MR1 matches once per wrap; the handler checks the full count, so
+    // targets further away than that just see early interrupts
+    _regs.MR1 = _state[_index].next & max_count();
+    _regs.MCR |= MCR_MR1_INT_ENABLED;
+
+    // the count may have reached the target before MR1 was written
+    if (count() >= _state[_index].next) {
+        trigger(CHANNEL_MR1);
+    }
+}
+
+void
+Counter::wrap(unsigned index, Channel channel, void *context)
+{
+    (void)channel;
+    (void)context;
+    _state[index].wraps++;
+}
+
+void
+Counter::match(unsigned index, Channel channel, void *context)
+{
+    (void)context;
+    auto counter = Counter(index);
+    auto &s = _state[index];
+
+    if (s.interval == 0) {
+        return;
+    }
+
+    auto now = counter.count();
+
+    // more than one interval may have gone by if events are fast
+    while ((s.interval > 0) && (now >= s.next)) {
+        s.next += s.interval;
+        s.callback(index, channel, s.context);
+    }
+
+    if (s.interval > 0) {
+        counter.set_match();
+    }
+}
@@ -0,0 +1,189 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <deadline_timer.h>
+#include <interrupt.h>
+
+DeadlineTimer   *DeadlineTimer::_heap[CONFIG_DEADLINE_TIMERS];
+unsigned        DeadlineTimer::_count;
+
+bool
+DeadlineTimer::start(uint32_t delay, uint32_t period)
+{
+    return start_at(Timebase.time() + delay, period);
+}
+
+bool
+DeadlineTimer::start_at(_Timebase::microseconds when, uint32_t period)
+{
+    BEGIN_CRITICAL_SECTION;
+
+    if (active()) {
+        remove(this);
+    } else if (_count >= CONFIG_DEADLINE_TIMERS) {
+        return false;
+    }
+
+    _due = when;
+    _period = period;
+    insert(this);
+    reprogram();
+
+    END_CRITICAL_SECTION;
+    return true;
+}
+
+void
+DeadlineTimer::stop()
+{
+    BEGIN_CRITICAL_SECTION;
+
+    if (active()) {
+        remove(this);
+        reprogram();
+    }
+
+    END_CRITICAL_SECTION;
+}
+
+void
+DeadlineTimer::insert(DeadlineTimer *timer)
+{
+    place(timer, _count++);
+    sift_up(timer->_slot);
+}
+
+void
+DeadlineTimer::remove(DeadlineTimer *timer)
+{
+    unsigned slot = timer->_slot;
+    timer->_slot = -1;
+
+    // move the last entry into the hole and let it find its level; it may
+    // need to go either way
+    if (slot != --_count) {
+        auto moved = _heap[_count];
+        place(moved, slot);
+        sift_up(slot);
+        sift_down(moved->_slot);
+    }
+
+    _heap[_count] = nullptr;
+}
+
+void
+DeadlineTimer::place(DeadlineTimer *timer, unsigned slot)
+{
+    _heap[slot] = timer;
+    timer->_slot = slot;
+}
+
+void
+DeadlineTimer::sift_up(unsigned slot)
+{
+    auto timer = _heap[slot];
+
+    while (slot > 0) {
+        auto parent = (slot - 1) / 2;
+
+        if (_heap[parent]->_due <= timer->_due) {
+            break;
+        }
+
+        place(_heap[parent], slot);
+        slot = parent;
+    }
+
+    place(timer, slot);
+}
+
+void
+DeadlineTimer::sift_down(unsigned slot)
+{
+    auto timer = _heap[slot];
+
+    for (;;) {
+        auto child = (2 * slot) + 1;
+
+        if (child >= _count) {
+            break;
+        }
+
+        if (((child + 1) < _count) && (_heap[child + 1]->_due < _heap[child]->_due)) {
+            child++;
+        }
+
+        if (timer->_due <= _heap[child]->_due) {
+            break;
+        }
+
+        place(_heap[child], slot);
+        slot = child;
+    }
+
+    place(timer, slot);
+}
+
+void
+DeadlineTimer::reprogram()
+{
+    if (_count > 0) {
+        Timebase.set_alarm(_heap[0]->_due, &DeadlineTimer::expire);
+    } else {
+        Timebase.cancel_alarm();
+    }
+}
+
+void
+DeadlineTimer::expire(unsigned index, Timer::Channel channel, void *context)
+{
+    (void)index;
+    (void)channel;
+    (void)context;
+    auto now = Timebase.time();
+
+    while ((_count > 0) && (_heap[0]->_due <= now)) {
+        auto timer = _heap[0];
+        remove(timer);
+
+        // periodic timers keep their phase, unless they have fallen more
+        // than a whole period behind
+        if (timer->_period > 0) {
+            timer->_due += timer->_period;
+
+            if (timer->_due <= now) {
+                timer->_due = now + timer->_period;
+            }
+
+            insert(timer);
+        }
+
+        timer->_callback(timer->_context);
+    }
+
+    reprogram();
+}
@@ -0,0 +1,142 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <eeprom.h>
+#include <timer.h>
+
+#include "config.h"
+
+I2C::State
+EEPROM::read(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+    if ((address + length) > _size) {
+        return I2C::ERROR;
+    }
+
+    while (length > 0) {
+        // sequential reads don't reliably cross address blocks
+        auto count = block_size() - (address % block_size());
+
+        if (count > length) {
+            count = length;
+        }
+
+        if (count > 0xffff) {
+            count = 0xffff;
+        }
+
+        auto result = transfer(address, nullptr, 0, buffer, count);
+
+        if (result != I2C::ACK) {
+            return result;
+        }
+
+        address += count;
+        buffer += count;
+        length -= count;
+    }
+
+    return I2C::ACK;
+}
+
+I2C::State
+EEPROM::write(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+    if ((address + length) > _size) {
+        return I2C::ERROR;
+    }
+
+    while (length > 0) {
+        // page writes wrap within the page, so never cross a boundary
+        auto count = _pageSize - (address % _pageSize);
+
+        if (count > length) {
+            count = length;
+        }
+
+        auto result = transfer(address, buffer, count, nullptr, 0);
+
+        if (result != I2C::ACK) {
+            return result;
+        }
+
+        // the device is now busy until the write cycle completes
+        _writePending = true;
+        _writeDeadline = Timebase.time() + CONFIG_EEPROM_WRITE_TIMEOUT_US;
+
+        address += count;
+        buffer += count;
+        length -= count;
+    }
+
+    return I2C::ACK;
+}
+
+I2C::State
+EEPROM::sync()
+{
+    if (!_writePending) {
+        return I2C::ACK;
+    }
+
+    // an address-only probe
+    return transfer(0, nullptr, 0, nullptr, 0);
+}
+
+I2C::State
+EEPROM::transfer(uint32_t address,
+                 const uint8_t *writeBuffer,
+                 uint16_t writeLength,
+                 uint8_t *readBuffer,
+                 uint16_t readLength)
+{
+    // upper address bits that don't fit in the word address go in the
+    // slave address
+    auto slave = _slave | ((address >> (8 * _addressing - 1)) & 0x0e);
+    uint8_t header[] = { (uint8_t)(address >> 8), (uint8_t)(address & 0xff) };
+    auto headerLength = ((writeLength > 0) || (readLength > 0)) ? (uint16_t)_addressing : (uint16_t)0;
+
+    for (;;) {
+        auto result = _bus.transfer(slave,
+                                    header + sizeof(header) - _addressing, headerLength,
+                                    writeBuffer, writeLength,
+                                    readBuffer, readLength);
+
+        // A NACK while a write cycle is in progress just means the device
+        // is still busy; keep trying until it answers or we run out of time.
+        if ((result == I2C::NACK)
+            && _writePending
+            && (Timebase.time() < _writeDeadline)) {
+            continue;
+        }
+
+        if (result == I2C::ACK) {
+            _writePending = false;
+        }
+
+        return result;
+    }
+}
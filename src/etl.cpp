@@ -30,6 +30,10 @@
 namespace ETL
 {
 
+#if CONFIG_ETL_NUM_CALLBACK_TIMERS > 0
+static uint32_t callback_ticks_elapsed = 0;
+#endif
+
 void
 init(void)
 {
@@ -48,7 +52,6 @@ void
 millisecond_tick()
 {
 #if CONFIG_ETL_NUM_CALLBACK_TIMERS > 0
-    static uint32_t callback_ticks_elapsed = 0;
 
     if (callback_timer.tick(++callback_ticks_elapsed)) {
         callback_ticks_elapsed = 0;
@@ -57,6 +60,19 @@ millisecond_tick()
 #endif
 }
 
+uint32_t
+ticks_to_next()
+{
+#if CONFIG_ETL_NUM_CALLBACK_TIMERS > 0
+    auto next = callback_timer.time_to_next();
+
+    // ticks that haven't been delivered yet count towards the next expiry
+    return (next > callback_ticks_elapsed) ? (next - callback_ticks_elapsed) : 0;
+#else
+    return UINT32_MAX;
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // callback timers
 //
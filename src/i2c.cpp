@@ -29,33 +29,167 @@
 #include <syscon.h>
 #include <pin.h>
 
+#include <timer.h>
+#include <debug.h>
+
 #include "config.h"
 
 I2C     I2C0;
 
+namespace
+{
+
+// half a bit-time at 100kHz
+void
+bus_delay()
+{
+    auto until = Timebase.time() + 5;
+
+    while (Timebase.time() < until) {
+    }
+}
+
+// wait for a (possibly clock-stretching) slave to release SCL
+void
+scl_wait_high()
+{
+    auto until = Timebase.time() + CONFIG_I2C_TIMEOUT_US;
+
+    while (!P0_4.get() && (Timebase.time() < until)) {
+    }
+
+    bus_delay();
+}
+
+};
+
 I2C::State
 I2C::transfer(uint8_t slave,
-              uint8_t *writeBuffer,
-              uint8_t writeLength,
+              const uint8_t *headerBuffer,
+              uint16_t headerLength,
+              const uint8_t *writeBuffer,
+              uint16_t writeLength,
               uint8_t *readBuffer,
-              uint8_t readLength)
+              uint16_t readLength,
+              uint8_t swap)
 {
+#if CONFIG_I2C_STATS_SLAVES > 0
+    auto startTime = Timebase.time();
+#endif
+
+    // poll short transfers, and anything when we can't sleep waiting for
+    // an interrupt: with interrupts masked, or from a handler
+#ifdef WITH_SCMRTOS
+    auto can_block = os_started && (__get_PRIMASK() == 0) && (__get_IPSR() == 0);
+#else
+    auto can_block = (__get_PRIMASK() == 0) && (__get_IPSR() == 0);
+#endif
+    auto length = headerLength + writeLength + readLength;
+    auto polled = (length <= _pollThreshold) || !can_block;
+
     // claim ownership of the interface
+#ifdef WITH_SCMRTOS
+
+    if (!os_started) {
+        // before the OS runs there is only one thread, so only the flag
+        // is needed
+        auto expected = false;
+
+        if (!_busy.compare_exchange_strong(expected, true)) {
+            return ERROR;
+        }
+    } else if (!can_block) {
+        // can't block with interrupts masked or in a handler
+        if (!_lock.try_lock()) {
+            return ERROR;
+        }
+
+        _busy.store(true);
+    } else {
+        _lock.lock();
+        _busy.store(true);
+    }
+
+    _done.clear();
+#else
     auto expected = false;
 
     if (!_busy.compare_exchange_strong(expected, true)) {
         return ERROR;
     }
 
+#endif
+
     _state = IDLE;
+    _polled = polled;
     _slave = slave;
+    _swap = swap;
+
+    _headerBuffer = etl::array_view<const uint8_t>(headerBuffer, headerLength);
+    _headerIter = _headerBuffer.begin();
+
+    _writeBuffer = etl::array_view<const uint8_t>(writeBuffer, writeLength);
+    _writeIndex = 0;
+
+    _readBuffer = etl::array_view<uint8_t>(readBuffer, readLength);
+    _readIndex = 0;
 
-    _writeBuffer = etl::array_view<unsigned char>(writeBuffer, writeLength);
-    _writeIter = _writeBuffer.begin();
+#if CONFIG_I2C_STATS_SLAVES > 0
+    _interruptTime = 0;
+    _arbitrationLost = false;
+#endif
 
-    _readBuffer = etl::array_view<unsigned char>(readBuffer, readLength);
-    _readIter = _readBuffer.begin();
+    // the transfer must be done by this time or we assume the bus is stuck
+    auto deadline = Timebase.time()
+                    + CONFIG_I2C_TIMEOUT_US
+                    + length * CONFIG_I2C_BYTE_TIMEOUT_US;
+
+    init();
+
+    // start the transfer and wait for a terminal state
+    if (start(deadline)) {
+        wait(deadline);
+    }
+
+    // make sure the STOP condition has been sent before we turn the
+    // controller off
+    if ((_state == ACK) || (_state == NACK)) {
+        if (!stop(deadline)) {
+            I2C_IRQ.disable();
+            _state = TIMEOUT;
+        }
+    }
+
+    // if the bus is stuck, try to get it moving again
+    if (_state == TIMEOUT) {
+        if (recover()) {
+            _state = RECOVERED;
+        }
+    }
 
+    // relinquish the controller
+    auto result = _state;
+
+    SYSCON_I2C.clock(false);
+    I2C_IRQ.disable();
+#if CONFIG_I2C_STATS_SLAVES > 0
+    recordStats(startTime, result);
+#endif
+    _busy.store(false);
+#ifdef WITH_SCMRTOS
+
+    if (os_started) {
+        _lock.unlock();
+    }
+
+#endif
+
+    return result;
+}
+
+void
+I2C::init()
+{
     // take block out of reset
     SYSCON_I2C.reset();
     // enable clock
@@ -83,65 +217,115 @@ I2C::transfer(uint8_t slave,
     LPC_I2C->SCLL = CONFIG_CPU_FREQUENCY / 200000;
     LPC_I2C->SCLH = CONFIG_CPU_FREQUENCY / 200000;
 
-    // enable interrupt
-    I2C_IRQ.enable();
+    // enable interrupt, unless we are going to poll; discard anything
+    // left pending by a previous polled transfer
+    I2C_IRQ.clear_pending();
 
-    // start the transfer
+    if (!_polled) {
+        I2C_IRQ.enable();
+    }
+
+    // enable the controller
     LPC_I2C->CONSET = CONSET_I2EN;
+}
 
-    if (!start()) {
-        stop();
-        goto done;
+bool
+I2C::start(uint64_t deadline)
+{
+    LPC_I2C->CONSET = CONSET_STA;
+
+    // make sure it starts - if the bus is held by a confused slave
+    // this will time out
+    while (_state == IDLE) {
+        poll();
+
+        if ((Timebase.time() > deadline) && expire(PENDING)) {
+            return false;
+        }
     }
 
-    // wait for a non-terminal state
+    return true;
+}
+
+void
+I2C::wait(uint64_t deadline)
+{
     while (_state < TERMINAL_STATE) {
-        // WFI?
-        // timeout?
-    }
+        auto now = Timebase.time();
 
-    // relinquish the controller
-done:
-    auto result = _state;
+        if (now > deadline) {
+            expire(TERMINAL_STATE);
+            break;
+        }
 
-    SYSCON_I2C.clock(false);
-    I2C_IRQ.disable();
-    _busy.store(false);
+        if (_polled) {
+            poll();
+            continue;
+        }
 
-    return result;
+#ifdef WITH_SCMRTOS
+        // sleep until the interrupt handler signals completion; other
+        // processes run in the meantime
+        _done.wait((timeout_t)((deadline - now) / 1000 + 1));
+#else
+        // sleep until the next interrupt; masking interrupts around the
+        // check ensures that completion can't sneak in before the WFI,
+        // and the caller's interrupt state is restored afterwards
+        BEGIN_CRITICAL_SECTION;
+
+        if (_state < TERMINAL_STATE) {
+            Interrupt::wait();
+        }
+
+        END_CRITICAL_SECTION;
+#endif
+    }
 }
 
 bool
-I2C::start()
+I2C::expire(State reached)
 {
-    LPC_I2C->CONSET = CONSET_STA;
-
-    // make sure it starts -
-    unsigned timeout = 0x1000000;
+    // keep the interrupt handler from updating the state while we decide;
+    // if it has just reached the state we were waiting for, carry on
+    I2C_IRQ.disable();
+    __DSB();
+    __ISB();
 
-    while (_state == IDLE) {
-        if (--timeout == 0) {
-            _state = ERROR;
-            return false;
+    if (_state >= reached) {
+        if (!_polled) {
+            I2C_IRQ.enable();
         }
+
+        return false;
     }
 
+    // the handler stays off, so TIMEOUT can't be overwritten
+    _state = TIMEOUT;
     return true;
 }
 
+void
+I2C::poll()
+{
+    // run the state machine from thread context if the controller
+    // wants attention
+    if (_polled && (LPC_I2C->CONSET & CONSET_SI)) {
+#if CONFIG_I2C_STATS_SLAVES > 0
+        auto entryTime = Timebase.time();
+        handleInterrupt();
+        _interruptTime += Timebase.time() - entryTime;
+#else
+        handleInterrupt();
+#endif
+    }
+}
 
 bool
-I2C::stop()
+I2C::stop(uint64_t deadline)
 {
-    LPC_I2C->CONSET = CONSET_STO;
-    LPC_I2C->CONCLR = CONCLR_SIC;
-
     // wait for stop bit to clear
-    unsigned timeout = 0x1000000;
-
     while (LPC_I2C->CONSET & CONSET_STO) {
-        if (--timeout == 0) {
-            _state = ERROR;
+        if (Timebase.time() > deadline) {
             return false;
         }
     }
@@ -149,6 +333,50 @@ I2C::stop()
     return true;
 }
 
+bool
+I2C::recover()
+{
+    // take the pins away from the controller
+    I2C_IRQ.disable();
+    LPC_I2C->CONCLR = CONCLR_AAC |
+                      CONCLR_SIC |
+                      CONCLR_STAC |
+                      CONCLR_I2ENC;
+    P0_5.configure(Gpio::Input);
+    P0_4.set();
+    P0_4.configure(Gpio::Output);
+    bus_delay();
+
+    // Clock out up to 9 bits; a slave that was part-way through sending
+    // a byte when we lost track of it will release SDA once it is done
+    // and sees the (NACK) 9th clock.
+    for (auto i = 0; (i < 9) && !P0_5.get(); i++) {
+        P0_4.clear();
+        bus_delay();
+        P0_4.set();
+        scl_wait_high();
+    }
+
+    // generate a STOP condition; SDA rising while SCL is high
+    P0_4.clear();
+    bus_delay();
+    P0_5.clear();
+    P0_5.configure(Gpio::Output);
+    bus_delay();
+    P0_4.set();
+    scl_wait_high();
+    P0_5.set();
+    bus_delay();
+
+    // if both lines are now idle the bus is free again
+    auto recovered = P0_4.get() && P0_5.get();
+
+    // give the pins back to the controller and re-init it
+    init();
+
+    return recovered;
+}
+
 void
 I2C::handleInterrupt()
 {
@@ -160,9 +388,15 @@ I2C::handleInterrupt()
     case 0x08:
         /*
          * A START condition has been transmitted.
-         * Send the slave address with the R bit clear.
+         * Send the slave address with the R bit clear, or set if this
+         * is a read with nothing to write first.
          */
-        LPC_I2C->DAT = _slave;
+        if (_headerBuffer.empty() && _writeBuffer.empty() && !_readBuffer.empty()) {
+            LPC_I2C->DAT = _slave | 1;
+        } else {
+            LPC_I2C->DAT = _slave;
+        }
+
         LPC_I2C->CONCLR = (CONCLR_SIC | CONCLR_STAC);
         _state = PENDING;
         break;
@@ -177,36 +411,14 @@ I2C::handleInterrupt()
         break;
 
     case 0x18:
-        /*
-         * SLA+W has been transmitted; ACK has been received.
-         * We now start writing bytes.
-         */
-        LPC_I2C->DAT = *_writeIter++;
-        LPC_I2C->CONCLR = CONCLR_SIC;
-        break;
-
-    case 0x20:
-        /*
-         * SLA+W has been transmitted; NOT ACK has been received.
-         * Send a stop condition to terminate the transaction
-         * and signal I2CEngine the transaction is aborted.
-         */
-        LPC_I2C->CONSET = CONSET_STO;
-        LPC_I2C->CONCLR = CONCLR_SIC;
-        _state = NACK;
-        break;
-
     case 0x28:
 
         /*
-         * Data in I2DAT has been transmitted; ACK has been received.
+         * SLA+W or data in I2DAT has been transmitted; ACK has been received.
          * Continue sending more bytes as long as there are bytes to send
          * and after this check if a read transaction should follow.
          */
-        if (_writeIter < _writeBuffer.end()) {
-            /* Keep writing as long as bytes avail */
-            LPC_I2C->DAT = *_writeIter++;
-        } else {
+        if (!sendNext()) {
             if (_readBuffer.size()) {
                 /* Send a Repeated START to initialize a read transaction */
                 /* (handled in state 0x10)                                */
@@ -220,6 +432,17 @@ I2C::handleInterrupt()
         LPC_I2C->CONCLR = CONCLR_SIC;
         break;
 
+    case 0x20:
+        /*
+         * SLA+W has been transmitted; NOT ACK has been received.
+         * Send a stop condition to terminate the transaction
+         * and signal I2CEngine the transaction is aborted.
+         */
+        LPC_I2C->CONSET = CONSET_STO;
+        LPC_I2C->CONCLR = CONCLR_SIC;
+        _state = NACK;
+        break;
+
     case 0x30:
         /*
          * Data byte in I2DAT has been transmitted; NOT ACK has been received
@@ -239,6 +462,9 @@ I2C::handleInterrupt()
          * Inform the I2CEngine of this and cancel the transaction
          * (this is automatically done by the I2C hardware)
          */
+#if CONFIG_I2C_STATS_SLAVES > 0
+        _arbitrationLost = true;
+#endif
         _state = ERROR;
         LPC_I2C->CONCLR = CONCLR_SIC;
         break;
@@ -279,9 +505,9 @@ I2C::handleInterrupt()
          * Read the byte and check for more bytes to read.
          * Send a NOT ACK after the last byte is received
          */
-        *_readIter++ = LPC_I2C->DAT;
+        _readBuffer[_readIndex++ ^ _swap] = LPC_I2C->DAT;
 
-        if (_readIter < _readBuffer.end()) {
+        if ((_readIndex + 1) < _readBuffer.size()) {
             /* lmore bytes to follow: send an ACK after data is received */
             LPC_I2C->CONSET = CONSET_AA;
         } else {
@@ -299,21 +525,166 @@ I2C::handleInterrupt()
          * Generate a STOP condition and flag the I2CEngine that the
          * transaction is finished.
          */
-        *_readIter++ = LPC_I2C->DAT;
+        _readBuffer[_readIndex++ ^ _swap] = LPC_I2C->DAT;
         _state = ACK;
         LPC_I2C->CONSET = CONSET_STO;   /* Set Stop flag */
         LPC_I2C->CONCLR = CONCLR_SIC;   /* Clear SI flag */
         break;
 
+    case 0x00:
+        /*
+         * Bus error; an illegal START or STOP was seen on the bus.
+         * Setting STO with SI cleared returns the controller to the
+         * not-addressed slave state without touching the bus.
+         */
+        LPC_I2C->CONSET = CONSET_STO;
+        LPC_I2C->CONCLR = CONCLR_SIC;
+        _state = ERROR;
+        break;
+
     }
 }
 
+bool
+I2C::sendNext()
+{
+    // header bytes go first, as-is
+    if (_headerIter < _headerBuffer.end()) {
+        LPC_I2C->DAT = *_headerIter++;
+        return true;
+    }
+
+    // then the payload, swapped if required
+    if (_writeIndex < _writeBuffer.size()) {
+        LPC_I2C->DAT = _writeBuffer[_writeIndex++ ^ _swap];
+        return true;
+    }
+
+    return false;
+}
+
+#if CONFIG_I2C_STATS_SLAVES > 0
+void
+I2C::recordStats(uint64_t startTime, State result)
+{
+    // find the slot for this slave, or a free one
+    Stats *slot = nullptr;
+
+    for (auto &s : _stats) {
+        if ((s.transfers > 0) && (s.slave == _slave)) {
+            slot = &s;
+            break;
+        }
+
+        if ((slot == nullptr) && (s.transfers == 0)) {
+            slot = &s;
+        }
+    }
+
+    if (slot == nullptr) {
+        return;
+    }
+
+    slot->slave = _slave;
+    slot->transfers++;
+
+    if (result == NACK) {
+        slot->nacks++;
+    }
+
+    if (_arbitrationLost) {
+        slot->arbitration_losses++;
+    }
+
+    if ((result == TIMEOUT) || (result == RECOVERED)) {
+        slot->timeouts++;
+    }
+
+    slot->interrupt_us += _interruptTime;
+
+    // bucket n holds latencies in [2^(n-1), 2^n)
+    auto latency = (uint32_t)(Timebase.time() - startTime);
+    unsigned bucket = (latency == 0) ? 0 : (32 - __builtin_clz(latency));
+
+    if (bucket >= STATS_BUCKETS) {
+        bucket = STATS_BUCKETS - 1;
+    }
+
+    slot->latency[bucket]++;
+}
+
+const I2C::Stats *
+I2C::stats(uint8_t slave) const
+{
+    for (auto &s : _stats) {
+        if ((s.transfers > 0) && (s.slave == slave)) {
+            return &s;
+        }
+    }
+
+    return nullptr;
+}
+
+void
+I2C::dumpStats() const
+{
+    for (auto &s : _stats) {
+        if (s.transfers == 0) {
+            continue;
+        }
+
+        debug("I2C 0x%02x: %lu transfers %lu NACK %lu arb %lu timeout %lu us servicing",
+              s.slave,
+              s.transfers,
+              s.nacks,
+              s.arbitration_losses,
+              s.timeouts,
+              s.interrupt_us);
+
+        for (auto bucket = 0U; bucket < STATS_BUCKETS; bucket++) {
+            if (s.latency[bucket] > 0) {
+                if (bucket < (STATS_BUCKETS - 1)) {
+                    debug("  <%6luus: %lu", 1UL << bucket, s.latency[bucket]);
+                } else {
+                    debug(" >=%6luus: %lu", 1UL << (bucket - 1), s.latency[bucket]);
+                }
+            }
+        }
+    }
+}
+
+void
+I2C::resetStats()
+{
+    for (auto &s : _stats) {
+        s = {};
+    }
+}
+#endif
+
 extern "C"
 void
 I2C_Handler()
 {
+#ifdef WITH_SCMRTOS
+    OS::TISRW isrw;
+#endif
+
     if (I2C0._busy) {
+#if CONFIG_I2C_STATS_SLAVES > 0
+        auto entryTime = Timebase.time();
+        I2C0.handleInterrupt();
+        I2C0._interruptTime += Timebase.time() - entryTime;
+#else
         I2C0.handleInterrupt();
+#endif
+#ifdef WITH_SCMRTOS
+
+        if (I2C0._state > I2C::TERMINAL_STATE) {
+            I2C0._done.signal_isr();
+        }
+
+#endif
     } else {
         I2C_IRQ.disable();
     }
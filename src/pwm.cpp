@@ -0,0 +1,145 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <pwm.h>
+#include <interrupt.h>
+
+PWM::Pending    PWM::_pending[4];
+
+void
+PWM::configure(const Config &config, unsigned channels)
+{
+    if ((config.prescale == 0) || (config.period < 2)) {
+        return;
+    }
+
+    cancel();
+    _pending[_index].mask = 0;
+    _regs.CTCR = CTCR_CTMODE_TIMER;
+    _regs.PR = config.prescale - 1;
+    _regs.MR3 = config.period - 1;
+
+    // a match value past the end of the period is never reached, so the
+    // output stays low
+    _regs.MR0 = config.period;
+    _regs.MR1 = config.period;
+    _regs.MR2 = config.period;
+
+    _regs.PWMC = channels & (PWMC_PWM0_MASK | PWMC_PWM1_MASK | PWMC_PWM2_MASK);
+    _regs.MCR = MCR_MR3_RESET_ENABLED;
+    set_callback(CHANNEL_MR0, &PWM::edge);
+    set_callback(CHANNEL_MR1, &PWM::edge);
+    set_callback(CHANNEL_MR2, &PWM::edge);
+    set_callback(CHANNEL_MR3, &PWM::restart);
+    _regs.TCR = TCR_COUNTERENABLE_ENABLED | TCR_COUNTERRESET_DISABLED;
+    _irq.enable();
+}
+
+void
+PWM::set_width(unsigned channel, uint32_t width)
+{
+    if (channel > 2) {
+        return;
+    }
+
+    auto limit = period();
+
+    if (width > limit) {
+        width = limit;
+    }
+
+    // output goes high at the match, and MR 0 means high all the time
+    BEGIN_CRITICAL_SECTION;
+    auto &p = _pending[_index];
+    p.match[channel] = limit - width;
+    p.mask |= 1U << channel;
+
+    // update after the output goes high in this period, or at the start
+    // of the next if it stays low
+    if ((&_regs.MR0)[channel] < limit) {
+        _regs.MCR |= match_interrupt((Channel)channel);
+    } else {
+        _regs.MCR |= MCR_MR3_INT_ENABLED;
+    }
+
+    END_CRITICAL_SECTION;
+}
+
+void
+PWM::edge(unsigned index, Channel channel, void *context)
+{
+    (void)context;
+    auto pwm = PWM(index);
+    auto &p = _pending[index];
+    auto bit = 1U << channel;
+
+    if (!(p.mask & bit)) {
+        return;
+    }
+
+    auto &match = (&pwm._regs.MR0)[channel];
+    auto value = p.match[channel];
+    uint32_t count = pwm._regs.TC;
+
+    // Normally the output went high at the old match earlier in this
+    // period and stays high to the end of it, so any new value is safe.
+    // If the period ended before we got here, the output is low and the
+    // old match is still to come; the new value is only safe if it is
+    // still ahead of the count, otherwise try again after the next edge.
+    if ((count < match) && (value <= (count + GUARD_TICKS))) {
+        return;
+    }
+
+    match = value;
+    p.mask &= ~bit;
+    pwm._regs.MCR &= ~match_interrupt(channel);
+}
+
+void
+PWM::restart(unsigned index, Channel channel, void *context)
+{
+    (void)channel;
+    (void)context;
+    auto pwm = PWM(index);
+    auto &p = _pending[index];
+    auto limit = pwm.period();
+
+    // the period has just restarted; channels that were low throughout the
+    // last one can take their new values now, as missing a match here
+    // just leaves them low for one more period
+    for (auto channel = 0U; channel < 3; channel++) {
+        auto bit = 1U << channel;
+        auto &match = (&pwm._regs.MR0)[channel];
+
+        if ((p.mask & bit) && (match >= limit)) {
+            match = p.match[channel];
+            p.mask &= ~bit;
+        }
+    }
+
+    pwm._regs.MCR &= ~MCR_MR3_INT_MASK;
+}
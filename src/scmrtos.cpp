@@ -97,9 +97,12 @@ PROCESS_DEF(6)
 PROCESS_DEF(7)
 #endif
 
+volatile bool os_started;
+
 int
 main()
 {
+    os_started = true;
     OS::run();
 }
 
@@ -107,11 +110,157 @@ main()
 
 #if scmRTOS_IDLE_HOOK_ENABLE
 
+#if CONFIG_TICKLESS_IDLE
+
+// Tickless idle.
+//
+// When everything is blocked, stop the SysTick interrupt and sleep until
+// just before the tick on which the earliest process timeout or callback
+// timer expires, using a deadline timer on the Timebase. Any other
+// interrupt wakes us early; the Timebase's own half-period interrupts are
+// handled in place and we go back to sleep. The ticks slept through are
+// then replayed by calling the SysTick handler before interrupts are
+// unmasked, so the kernel's tick count, process timeouts and the ETL
+// timers are all up to date before anything else runs. The real SysTick
+// delivers the final tick on time, as its count keeps running throughout.
+
+#include <deadline_timer.h>
+#include <interrupt.h>
+
+namespace
+{
+
+// TBaseProcess::Timeout is protected, but a pointer to it can be taken
+// from a derived class and used on any process.
+class ProcessTimeout : public OS::TBaseProcess
+{
+public:
+    static timeout_t    get(uint_fast8_t priority)
+    {
+        return OS::get_proc(priority)->*(&ProcessTimeout::Timeout);
+    }
+};
+
+// Ticks until the earliest process timeout; zero timeouts are waiting
+// forever.
+uint32_t
+os_ticks_to_next()
+{
+    uint32_t next = UINT32_MAX;
+
+    for (uint_fast8_t priority = 0; priority < scmRTOS_PROCESS_COUNT; priority++) {
+        uint32_t timeout = ProcessTimeout::get(priority);
+
+        if ((timeout > 0) && (timeout < next)) {
+            next = timeout;
+        }
+    }
+
+    return next;
+}
+
+void
+wakeup_callback(void *context)
+{
+    (void)context;
+}
+
+DeadlineTimer   wakeup(&wakeup_callback);
+
+const uint32_t  CYCLES_PER_US = SYSTICKFREQ / 1000000;
+
+} // namespace
+
+extern "C" void __idle_hook()
+{
+    BEGIN_CRITICAL_SECTION;
+
+    auto ticks = os_ticks_to_next();
+    auto etl_ticks = ETL::ticks_to_next();
+
+    if (etl_ticks < ticks) {
+        ticks = etl_ticks;
+    }
+
+    if (ticks > CONFIG_TICKLESS_MAX_TICKS) {
+        ticks = CONFIG_TICKLESS_MAX_TICKS;
+    }
+
+    // nothing to gain unless at least one tick can be skipped; and a tick
+    // that is already pending must be delivered before we start counting
+    if ((ticks < 2) || (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)) {
+        Interrupt::wait();
+        break;
+    }
+
+    // sleep until the tick before the one that matters
+    uint32_t period = SysTick->LOAD + 1;
+    uint32_t early_phase = period - SysTick->VAL;
+    auto wake_at = Timebase.time()
+                   + ((period - early_phase) + ((uint64_t)(ticks - 2) * period)) / CYCLES_PER_US;
+
+    // no deadline timer to spare; just sleep with the tick running
+    if (!wakeup.start_at(wake_at)) {
+        Interrupt::wait();
+        break;
+    }
+
+    // From here ticks are counted rather than delivered. A tick that ends
+    // before TICKINT is cleared is pending and will be delivered normally;
+    // one that ends after it but before the start phase is sampled is
+    // neither, so count it in: VAL has reloaded but nothing is pending.
+    uint32_t check_phase = period - SysTick->VAL;
+    SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
+    uint32_t start_phase = period - SysTick->VAL;
+    auto start = Timebase.time();
+    uint32_t lost = ((start_phase < check_phase) && !(SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)) ? 1 : 0;
+
+    // with interrupts masked, a pending interrupt still wakes the CPU but
+    // isn't taken until the critical section ends
+    for (;;) {
+        Interrupt::wait();
+
+        if ((Timebase.time() >= wake_at) || !Timebase.absorb_wakeup()) {
+            break;
+        }
+    }
+
+    wakeup.stop();
+
+    // Tick boundaries crossed so far. The Timebase only gives the time to
+    // the microsecond, but the SysTick phase is exact, so the cycle count
+    // since the start of the first tick is rounded to a whole number of
+    // periods.
+    uint32_t phase = period - SysTick->VAL;
+    uint64_t slept = (Timebase.time() - start) * CYCLES_PER_US;
+    uint32_t elapsed = (slept + start_phase - phase + (period / 2)) / period + lost;
+
+    // A tick that ends between reading VAL and turning the interrupt back
+    // on is neither counted nor delivered; spot it by VAL having reloaded
+    // without the interrupt becoming pending.
+    SysTick->CTRL |= SysTick_CTRL_TICKINT_Msk;
+
+    if (((period - SysTick->VAL) < phase) && !(SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)) {
+        elapsed++;
+    }
+
+    // replay the ticks before anything else can run
+    while (elapsed-- > 0) {
+        SysTick_Handler();
+    }
+
+    END_CRITICAL_SECTION;
+}
+
+#else
+
 extern "C" void __idle_hook()
 {
     __WFI();
 }
 
+#endif // CONFIG_TICKLESS_IDLE
+
 extern "C" void __systick_hook()
 {
 }
@@ -0,0 +1,425 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <sd_card.h>
+#include <timer.h>
+
+SdCard::Status
+SdCard::init()
+{
+    _initialised = false;
+    _highCapacity = false;
+    _blocks = 0;
+    _slow.init();
+
+    // The card needs at least 74 clocks with CS deasserted before it will
+    // accept commands.
+    uint8_t idle[10];
+    auto bus = _slow.begin();
+    _slow.deselect();
+    bus.receive(idle, sizeof(idle));
+    _slow.end();
+
+    auto ssp = _slow.begin();
+    auto status = identify(ssp);
+    finish(_slow, ssp);
+
+    if (status != OK) {
+        return status;
+    }
+
+    _initialised = true;
+    return read_csd();
+}
+
+SdCard::Status
+SdCard::read(uint32_t block, uint8_t *buffer, uint32_t count)
+{
+    if (!_initialised || ((block + count) > _blocks)) {
+        return ERROR;
+    }
+
+    if (count == 0) {
+        return OK;
+    }
+
+    auto ssp = _fast.begin();
+    Status status;
+
+    if (count == 1) {
+        status = (command(ssp, CMD17_READ_SINGLE_BLOCK, address(block)) == 0) ? OK : ERROR;
+
+        if (status == OK) {
+            status = read_data(ssp, buffer, BLOCK_SIZE);
+        }
+    } else {
+        status = (command(ssp, CMD18_READ_MULTIPLE_BLOCK, address(block)) == 0) ? OK : ERROR;
+
+        // blocks follow one another with just a start token in between
+        while ((status == OK) && (count-- > 0)) {
+            status = read_data(ssp, buffer, BLOCK_SIZE);
+            buffer += BLOCK_SIZE;
+        }
+
+        command(ssp, CMD12_STOP_TRANSMISSION, 0);
+
+        if (wait_ready(ssp, CONFIG_SD_READ_TIMEOUT_US) != OK) {
+            status = TIMEOUT;
+        }
+    }
+
+    finish(_fast, ssp);
+    return status;
+}
+
+SdCard::Status
+SdCard::write(uint32_t block, const uint8_t *buffer, uint32_t count)
+{
+    if (!_initialised || ((block + count) > _blocks)) {
+        return ERROR;
+    }
+
+    if (count == 0) {
+        return OK;
+    }
+
+    auto ssp = _fast.begin();
+    Status status;
+
+    if (count == 1) {
+        status = (command(ssp, CMD24_WRITE_BLOCK, address(block)) == 0) ? OK : ERROR;
+
+        if (status == OK) {
+            status = write_data(ssp, TOKEN_START_BLOCK, buffer);
+        }
+    } else {
+        status = (command(ssp, CMD25_WRITE_MULTIPLE_BLOCK, address(block)) == 0) ? OK : ERROR;
+
+        while ((status == OK) && (count-- > 0)) {
+            status = write_data(ssp, TOKEN_START_MULTIPLE, buffer);
+            buffer += BLOCK_SIZE;
+        }
+
+        // the stop token is needed even if a block failed; the card is
+        // busy afterwards while it commits the last block
+        uint8_t stop[] = { TOKEN_STOP_TRANSMISSION, 0xff };
+        ssp.send(stop, sizeof(stop));
+
+        if ((wait_ready(ssp, CONFIG_SD_WRITE_TIMEOUT_US) != OK) && (status == OK)) {
+            status = TIMEOUT;
+        }
+    }
+
+    finish(_fast, ssp);
+    return status;
+}
+
+SdCard::Status
+SdCard::identify(SSP &ssp)
+{
+    // CMD0 with CS asserted puts the card into SPI mode; it may take a few
+    // attempts if the card was in the middle of something
+    auto r1 = (uint8_t)R1_INVALID;
+
+    for (auto tries = 0; (tries < 10) && (r1 != R1_IDLE); tries++) {
+        r1 = command(ssp, CMD0_GO_IDLE_STATE, 0);
+    }
+
+    if (r1 != R1_IDLE) {
+        return NO_CARD;
+    }
+
+    // CMD8 is only understood by v2 cards, which can be high capacity
+    bool v2 = false;
+    r1 = command(ssp, CMD8_SEND_IF_COND, 0x1aa);
+
+    if (!(r1 & R1_ILLEGAL_COMMAND)) {
+        uint8_t r7[4];
+        ssp.receive(r7, sizeof(r7));
+
+        if (((r7[2] & 0x0f) != 0x01) || (r7[3] != 0xaa)) {
+            return ERROR;
+        }
+
+        v2 = true;
+    }
+
+#if CONFIG_SD_CRC
+
+    if (command(ssp, CMD59_CRC_ON_OFF, 1) != R1_IDLE) {
+        return ERROR;
+    }
+
+#endif
+
+    auto deadline = Timebase.time() + CONFIG_SD_INIT_TIMEOUT_US;
+
+    do {
+        r1 = app_command(ssp, ACMD41_SD_SEND_OP_COND, v2 ? ACMD41_HCS : 0);
+
+        if (r1 == 0) {
+            break;
+        }
+
+        if (r1 != R1_IDLE) {
+            return ERROR;
+        }
+    } while (Timebase.time() < deadline);
+
+    if (r1 != 0) {
+        return TIMEOUT;
+    }
+
+    if (v2) {
+        uint8_t ocr[4];
+
+        if (command(ssp, CMD58_READ_OCR, 0) != 0) {
+            return ERROR;
+        }
+
+        ssp.receive(ocr, sizeof(ocr));
+        _highCapacity = ocr[0] & (OCR_CCS >> 24);
+    }
+
+    // standard capacity cards are byte-addressed with a variable block size
+    if (!_highCapacity
+        && (command(ssp, CMD16_SET_BLOCKLEN, BLOCK_SIZE) != 0)) {
+        return ERROR;
+    }
+
+    return OK;
+}
+
+SdCard::Status
+SdCard::read_csd()
+{
+    uint8_t csd[16];
+    auto ssp = _fast.begin();
+    auto status = (command(ssp, CMD9_SEND_CSD, 0) == 0) ? OK : ERROR;
+
+    if (status == OK) {
+        status = read_data(ssp, csd, sizeof(csd));
+    }
+
+    finish(_fast, ssp);
+
+    if (status != OK) {
+        return status;
+    }
+
+    if ((csd[0] >> 6) == 1) {
+        // CSD version 2.0; capacity in 512KiB units
+        uint32_t c_size = ((uint32_t)(csd[7] & 0x3f) << 16) | ((uint32_t)csd[8] << 8) | csd[9];
+        _blocks = (c_size + 1) * 1024;
+    } else {
+        // CSD version 1.0
+        uint32_t read_bl_len = csd[5] & 0x0f;
+        uint32_t c_size = ((uint32_t)(csd[6] & 0x03) << 10) | ((uint32_t)csd[7] << 2) | (csd[8] >> 6);
+        uint32_t c_size_mult = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+        _blocks = (c_size + 1) << (c_size_mult + 2 + read_bl_len - 9);
+    }
+
+    return OK;
+}
+
+uint8_t
+SdCard::command(SSP &ssp, Command cmd, uint32_t arg)
+{
+    // the card must be idle before it will accept a command, except when
+    // resetting or stopping a read in progress
+    if ((cmd != CMD0_GO_IDLE_STATE)
+        && (cmd != CMD12_STOP_TRANSMISSION)
+        && (wait_ready(ssp, CONFIG_SD_READ_TIMEOUT_US) != OK)) {
+        return R1_INVALID;
+    }
+
+    uint8_t frame[] = {
+        (uint8_t)(0x40 | cmd),
+        (uint8_t)(arg >> 24),
+        (uint8_t)(arg >> 16),
+        (uint8_t)(arg >> 8),
+        (uint8_t)arg,
+        0
+    };
+    frame[5] = (crc7(frame, 5) << 1) | 1;
+    ssp.send(frame, sizeof(frame));
+
+    // the byte following CMD12 is junk
+    if (cmd == CMD12_STOP_TRANSMISSION) {
+        uint8_t stuff;
+        ssp.receive(&stuff, 1);
+    }
+
+    // the response arrives within 8 bytes
+    uint8_t r1 = R1_INVALID;
+
+    for (auto i = 0; (i < 10) && (r1 & R1_INVALID); i++) {
+        ssp.receive(&r1, 1);
+    }
+
+    return r1;
+}
+
+uint8_t
+SdCard::app_command(SSP &ssp, Command cmd, uint32_t arg)
+{
+    auto r1 = command(ssp, CMD55_APP_CMD, 0);
+
+    if (r1 & ~R1_IDLE) {
+        return r1;
+    }
+
+    return command(ssp, cmd, arg);
+}
+
+SdCard::Status
+SdCard::wait_ready(SSP &ssp, uint32_t timeout)
+{
+    auto deadline = Timebase.time() + timeout;
+    uint8_t c;
+
+    do {
+        ssp.receive(&c, 1);
+
+        if (c == 0xff) {
+            return OK;
+        }
+    } while (Timebase.time() < deadline);
+
+    return TIMEOUT;
+}
+
+SdCard::Status
+SdCard::read_data(SSP &ssp, uint8_t *buffer, uint32_t length)
+{
+    auto deadline = Timebase.time() + CONFIG_SD_READ_TIMEOUT_US;
+    uint8_t token;
+
+    do {
+        ssp.receive(&token, 1);
+    } while ((token == 0xff) && (Timebase.time() < deadline));
+
+    if (token == 0xff) {
+        return TIMEOUT;
+    }
+
+    // anything else is an error token
+    if (token != TOKEN_START_BLOCK) {
+        return ERROR;
+    }
+
+    uint8_t crc[2];
+    ssp.receive(buffer, length);
+    ssp.receive(crc, sizeof(crc));
+
+#if CONFIG_SD_CRC
+
+    if (crc16(buffer, length) != (((uint16_t)crc[0] << 8) | crc[1])) {
+        return CRC_ERROR;
+    }
+
+#endif
+    return OK;
+}
+
+SdCard::Status
+SdCard::write_data(SSP &ssp, uint8_t token, const uint8_t *buffer)
+{
+#if CONFIG_SD_CRC
+    auto crc = crc16(buffer, BLOCK_SIZE);
+#else
+    uint16_t crc = 0xffff;
+#endif
+    uint8_t header[] = { 0xff, token };
+    uint8_t trailer[] = { (uint8_t)(crc >> 8), (uint8_t)crc };
+    uint8_t response;
+
+    ssp.send(header, sizeof(header));
+    ssp.send(buffer, BLOCK_SIZE);
+    ssp.send(trailer, sizeof(trailer));
+    ssp.receive(&response, 1);
+
+    switch (response & DATA_RESPONSE_MASK) {
+    case DATA_RESPONSE_ACCEPTED:
+        return wait_ready(ssp, CONFIG_SD_WRITE_TIMEOUT_US);
+
+    case DATA_RESPONSE_CRC_ERROR:
+        return CRC_ERROR;
+
+    default:
+        return ERROR;
+    }
+}
+
+void
+SdCard::finish(const SpiDevice &device, SSP &ssp)
+{
+    // the card only releases MISO on the clock edge after CS goes high
+    uint8_t c;
+    device.deselect();
+    ssp.receive(&c, 1);
+    device.end();
+}
+
+uint8_t
+SdCard::crc7(const uint8_t *buffer, unsigned length)
+{
+    uint8_t crc = 0;
+
+    while (length-- > 0) {
+        uint8_t d = *buffer++;
+
+        for (auto i = 0; i < 8; i++) {
+            crc <<= 1;
+
+            if ((d ^ crc) & 0x80) {
+                crc ^= 0x09;
+            }
+
+            d <<= 1;
+        }
+    }
+
+    return crc & 0x7f;
+}
+
+uint16_t
+SdCard::crc16(const uint8_t *buffer, unsigned length)
+{
+    // CRC-16/XMODEM, a byte at a time without a table
+    uint16_t crc = 0;
+
+    while (length-- > 0) {
+        crc = (crc >> 8) | (crc << 8);
+        crc ^= *buffer++;
+        crc ^= (crc & 0xff) >> 4;
+        crc ^= crc << 12;
+        crc ^= (crc & 0xff) << 5;
+    }
+
+    return crc;
+}
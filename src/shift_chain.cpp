@@ -0,0 +1,115 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <string.h>
+
+#include <shift_chain.h>
+#include <interrupt.h>
+
+ShiftChain  *ShiftChain::_chains[2];
+
+bool
+ShiftChain::start(uint32_t interval, SSP::Callback callback)
+{
+    if (_timer == CONFIG_TIMEBASE_TIMER) {
+        return false;
+    }
+
+    _callback = callback;
+    _latch.set();
+    _latch.configure(Gpio::Output, Pin::PushPull);
+
+    _chains[_ssp] = this;
+    Timer(_timer).periodic(interval, &ShiftChain::tick, this);
+    return true;
+}
+
+void
+ShiftChain::stop()
+{
+    Timer(_timer).cancel();
+
+    // let a refresh in progress finish
+    while (SSP(_ssp).busy()) {
+    }
+
+    _chains[_ssp] = nullptr;
+}
+
+void
+ShiftChain::write(const uint8_t *image)
+{
+    BEGIN_CRITICAL_SECTION;
+    memcpy(_pending, image, _length);
+    END_CRITICAL_SECTION;
+}
+
+unsigned
+ShiftChain::read(uint8_t *image)
+{
+    BEGIN_CRITICAL_SECTION;
+    memcpy(image, _in, _length);
+    return _sequence;
+    END_CRITICAL_SECTION;
+}
+
+void
+ShiftChain::refresh()
+{
+    auto ssp = SSP(_ssp);
+
+    // a device transaction or the previous refresh has the port; try
+    // again next time
+    if (ssp.held() || ssp.busy()) {
+        _overruns++;
+        return;
+    }
+
+    // the last transaction may have left the port set up for another
+    // device
+    ssp.apply(_config);
+    memcpy(_tx, _pending, _length);
+    ssp.transfer_async(_tx, _rx, _length, &ShiftChain::done);
+}
+
+void
+ShiftChain::complete()
+{
+    // a few extra cycles low for slow parts at low supply voltage
+    _latch.clear();
+    __NOP();
+    __NOP();
+    __NOP();
+    _latch.set();
+
+    memcpy(_in, _rx, _length);
+    _sequence++;
+
+    if (_callback != nullptr) {
+        _callback(_ssp);
+    }
+}
@@ -0,0 +1,185 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <spi_display.h>
+#include <timer.h>
+
+void
+SpiDisplay::init(uint8_t madctl)
+{
+    _command.init();
+    _dc.set();
+    _dc.configure(Gpio::Output, Pin::PushPull);
+
+    // the controller needs time to come out of reset and sleep
+    command(CMD_SWRESET);
+    delay(150000);
+    command(CMD_SLPOUT);
+    delay(120000);
+
+    uint8_t colmod = COLMOD_RGB565;
+    command(CMD_COLMOD, &colmod, 1);
+    command(CMD_MADCTL, &madctl, 1);
+    command(CMD_DISPON);
+
+    // display RAM is garbage until drawn
+    invalidate();
+}
+
+void
+SpiDisplay::command(uint8_t cmd, const uint8_t *params, unsigned length)
+{
+    // send() waits for the last frame, so D/C can be switched afterwards
+    _dc.clear();
+    auto ssp = _command.begin();
+    ssp.send(&cmd, 1);
+
+    if (length > 0) {
+        _dc.set();
+        ssp.send(params, length);
+    }
+
+    _command.end();
+    _dc.set();
+}
+
+void
+SpiDisplay::invalidate(unsigned x, unsigned y, unsigned width, unsigned height)
+{
+    if ((x >= _width) || (y >= _height) || (width == 0) || (height == 0)) {
+        return;
+    }
+
+    Rect r = {
+        (uint16_t)x,
+        (uint16_t)y,
+        (uint16_t)(((x + width) > _width) ? _width : (x + width)),
+        (uint16_t)(((y + height) > _height) ? _height : (y + height))
+    };
+
+    // absorb every rectangle that overlaps or touches this one; merging
+    // may make the result touch rectangles it didn't before, so rescan
+    for (auto i = 0U; i < _numDirty;) {
+        auto &d = _dirty[i];
+
+        if ((r.x0 <= d.x1) && (d.x0 <= r.x1) && (r.y0 <= d.y1) && (d.y0 <= r.y1)) {
+            r = merge(r, d);
+            _dirty[i] = _dirty[--_numDirty];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (_numDirty < CONFIG_DISPLAY_DIRTY_RECTS) {
+        _dirty[_numDirty++] = r;
+        return;
+    }
+
+    // out of slots; merge with the rectangle that grows the least
+    auto best = 0U;
+    auto best_growth = ~0U;
+
+    for (auto i = 0U; i < _numDirty; i++) {
+        auto growth = merge(r, _dirty[i]).area() - _dirty[i].area();
+
+        if (growth < best_growth) {
+            best = i;
+            best_growth = growth;
+        }
+    }
+
+    _dirty[best] = merge(r, _dirty[best]);
+}
+
+void
+SpiDisplay::update(Renderer renderer, void *context)
+{
+    for (auto i = 0U; i < _numDirty; i++) {
+        draw(_dirty[i], renderer, context);
+    }
+
+    _numDirty = 0;
+}
+
+void
+SpiDisplay::draw(const Rect &rect, Renderer renderer, void *context)
+{
+    unsigned x0 = rect.x0 + _xoffset;
+    unsigned x1 = rect.x1 - 1 + _xoffset;
+    unsigned y0 = rect.y0 + _yoffset;
+    unsigned y1 = rect.y1 - 1 + _yoffset;
+    uint8_t caset[] = { (uint8_t)(x0 >> 8), (uint8_t)x0, (uint8_t)(x1 >> 8), (uint8_t)x1 };
+    uint8_t raset[] = { (uint8_t)(y0 >> 8), (uint8_t)y0, (uint8_t)(y1 >> 8), (uint8_t)y1 };
+
+    command(CMD_CASET, caset, sizeof(caset));
+    command(CMD_RASET, raset, sizeof(raset));
+
+    // RAMWR as an 8-bit frame, then switch the bus to 16-bit frames for
+    // the pixel data without releasing chip-select
+    uint8_t ramwr = CMD_RAMWR;
+    _dc.clear();
+    _command.begin().send(&ramwr, 1);
+    _dc.set();
+    auto ssp = _pixels.begin();
+
+    // the window wraps rows for us, so spans are just sent back to back
+    for (unsigned y = rect.y0; y < rect.y1; y++) {
+        for (unsigned x = rect.x0; x < rect.x1; x += CONFIG_DISPLAY_LINE_PIXELS) {
+            auto count = rect.x1 - x;
+
+            if (count > CONFIG_DISPLAY_LINE_PIXELS) {
+                count = CONFIG_DISPLAY_LINE_PIXELS;
+            }
+
+            renderer(context, x, y, count, _line);
+            ssp.send(_line, count);
+        }
+    }
+
+    _pixels.end();
+}
+
+SpiDisplay::Rect
+SpiDisplay::merge(const Rect &a, const Rect &b)
+{
+    return {
+        (a.x0 < b.x0) ? a.x0 : b.x0,
+        (a.y0 < b.y0) ? a.y0 : b.y0,
+        (a.x1 > b.x1) ? a.x1 : b.x1,
+        (a.y1 > b.y1) ? a.y1 : b.y1
+    };
+}
+
+void
+SpiDisplay::delay(unsigned us)
+{
+    auto deadline = Timebase.time() + us;
+
+    while (Timebase.time() < deadline) {
+    }
+}
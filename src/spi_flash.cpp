@@ -0,0 +1,245 @@
+// Copyright (c) 2019 Michael Smith, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <string.h>
+
+#include <spi_flash.h>
+#include <timer.h>
+
+SpiFlash::Status
+SpiFlash::probe()
+{
+    uint8_t cmd = CMD_READ_JEDEC_ID;
+    uint8_t id[3];
+
+    auto ssp = _device.begin();
+    ssp.send(&cmd, 1);
+    ssp.receive(id, sizeof(id));
+    _device.end();
+
+    _jedecId = ((uint32_t)id[0] << 16) | ((uint32_t)id[1] << 8) | id[2];
+    _cacheLength = 0;
+
+    // capacity is encoded as log2(bytes); anything outside 64KiB-16MiB is
+    // either a missing device or one we can't address
+    if ((id[2] < 16) || (id[2] > 24)) {
+        _size = 0;
+        return ERROR;
+    }
+
+    _size = 1UL << id[2];
+    return OK;
+}
+
+SpiFlash::Status
+SpiFlash::read(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+    if ((address + length) > _size) {
+        return ERROR;
+    }
+
+    // serve small reads from the cache, refilling it from the start of the
+    // read if it doesn't cover the whole request
+    if (length <= sizeof(_cache)) {
+        if ((address < _cacheAddress)
+            || ((address + length) > (_cacheAddress + _cacheLength))) {
+            auto status = sync();
+
+            if (status != OK) {
+                return status;
+            }
+
+            _cacheAddress = address;
+            _cacheLength = _size - address;
+
+            if (_cacheLength > sizeof(_cache)) {
+                _cacheLength = sizeof(_cache);
+            }
+
+            fast_read(_cacheAddress, _cache, _cacheLength);
+        }
+
+        memcpy(buffer, &_cache[address - _cacheAddress], length);
+        return OK;
+    }
+
+    auto status = sync();
+
+    if (status != OK) {
+        return status;
+    }
+
+    fast_read(address, buffer, length);
+    return OK;
+}
+
+SpiFlash::Status
+SpiFlash::write(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+    if ((address + length) > _size) {
+        return ERROR;
+    }
+
+    invalidate(address, length);
+
+    while (length > 0) {
+        // page programs wrap within the page, so never cross a boundary
+        auto count = PAGE_SIZE - (address % PAGE_SIZE);
+
+        if (count > length) {
+            count = length;
+        }
+
+        auto status = sync();
+
+        if (status != OK) {
+            return status;
+        }
+
+        write_command(CMD_PAGE_PROGRAM, address, buffer, count);
+        set_busy(CONFIG_SPI_FLASH_PROGRAM_TIMEOUT_US);
+
+        address += count;
+        buffer += count;
+        length -= count;
+    }
+
+    return OK;
+}
+
+SpiFlash::Status
+SpiFlash::erase(uint32_t address, uint32_t length)
+{
+    if (((address + length) > _size)
+        || ((address % SECTOR_SIZE) != 0)
+        || ((length % SECTOR_SIZE) != 0)) {
+        return ERROR;
+    }
+
+    invalidate(address, length);
+
+    while (length > 0) {
+        auto status = sync();
+
+        if (status != OK) {
+            return status;
+        }
+
+        write_command(CMD_SECTOR_ERASE, address, nullptr, 0);
+        set_busy(CONFIG_SPI_FLASH_ERASE_TIMEOUT_US);
+
+        address += SECTOR_SIZE;
+        length -= SECTOR_SIZE;
+    }
+
+    return OK;
+}
+
+SpiFlash::Status
+SpiFlash::sync()
+{
+    if (!_busy) {
+        return OK;
+    }
+
+    // the status register is sent repeatedly for as long as the command
+    // is active, so poll it in a single transaction
+    uint8_t cmd = CMD_READ_STATUS;
+    uint8_t status;
+    auto ssp = _device.begin();
+    ssp.send(&cmd, 1);
+
+    do {
+        ssp.receive(&status, 1);
+
+        if (!(status & STATUS_WIP)) {
+            _busy = false;
+            break;
+        }
+    } while (Timebase.time() < _busyDeadline);
+
+    _device.end();
+    return _busy ? TIMEOUT : OK;
+}
+
+void
+SpiFlash::fast_read(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+    // command, address and one dummy byte
+    uint8_t header[] = {
+        CMD_FAST_READ,
+        (uint8_t)(address >> 16),
+        (uint8_t)(address >> 8),
+        (uint8_t)address,
+        0
+    };
+
+    auto ssp = _device.begin();
+    ssp.send(header, sizeof(header));
+    ssp.receive(buffer, length);
+    _device.end();
+}
+
+void
+SpiFlash::write_command(Command cmd, uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+    uint8_t wren = CMD_WRITE_ENABLE;
+    _device.begin().send(&wren, 1);
+    _device.end();
+
+    uint8_t header[] = {
+        cmd,
+        (uint8_t)(address >> 16),
+        (uint8_t)(address >> 8),
+        (uint8_t)address
+    };
+
+    auto ssp = _device.begin();
+    ssp.send(header, sizeof(header));
+
+    if (length > 0) {
+        ssp.send(buffer, length);
+    }
+
+    _device.end();
+}
+
+void
+SpiFlash::invalidate(uint32_t address, uint32_t length)
+{
+    if ((address < (_cacheAddress + _cacheLength))
+        && ((address + length) > _cacheAddress)) {
+        _cacheLength = 0;
+    }
+}
+
+void
+SpiFlash::set_busy(uint32_t timeout)
+{
+    _busy = true;
+    _busyDeadline = Timebase.time() + timeout;
+}
@@ -27,61 +27,492 @@
 #include "ssp.h"
 #include "syscon.h"
 
+SSP::Async  SSP::_async[2];
+volatile bool SSP::_held[2];
+SSP::Slave  SSP::_slave[2];
+uint16_t    SSP::_fill[2] = { 0xffff, 0xffff };
+
+SSP &
+SSP::configure(unsigned rate, unsigned nbits, unsigned mode, Format format)
+{
+    init(config_for(rate, nbits, mode, format));
+
+    return *this;
+}
+
 SSP &
-SSP::configure(unsigned rate, unsigned nbits, unsigned mode)
+SSP::apply(const Config &config)
 {
-    Syscon::set_ssp0_prescale(1);
+    if ((_reg.CR1 & CR1_SSE_MASK) == CR1_SSE_DISABLED) {
+        init(config);
+    } else {
+        if (prescaler() != config.prescale) {
+            prescaler() = config.prescale;
+        }
+
+        if (_reg.CPSR != config.cpsr) {
+            _reg.CPSR = config.cpsr;
+        }
+
+        if (_reg.CR0 != config.cr0) {
+            _reg.CR0 = config.cr0;
+        }
+    }
+
+    return *this;
+}
+
+void
+SSP::init(const Config &config)
+{
+    prescaler() = config.prescale;
     _syscon.clock(true);
     _syscon.reset();
-    _reg.CPSR = CPSR_CPSDVSR_DIV2;
-    _reg.CR0 = ((CR0_DSS_4BIT + (nbits - 4)) |
-                CR0_FRF_SPI |
-                ((mode == 0) ? CR0_CPOL_LOW | CR0_CPHA_FIRST :
-                 (mode == 1) ? CR0_CPOL_LOW | CR0_CPHA_SECOND :
-                 (mode == 2) ? CR0_CPOL_HIGH | CR0_CPHA_FIRST : CR0_CPOL_HIGH | CR0_CPHA_SECOND) |
-                ((Syscon::PCLK_FREQ / (2 * rate) - 1) << 8));
+    _reg.CPSR = config.cpsr;
+    _reg.CR0 = config.cr0;
     _reg.CR1 = 0;
     _reg.CR1 = CR1_SSE_ENABLED | CR1_MS_MASTER;
+}
 
-    return *this;
+void
+SSP::transfer(const uint8_t *source, uint8_t *destination, unsigned count)
+{
+    transfer_sync(source, destination, count);
 }
 
 void
-SSP::transfer(uint8_t *source, uint8_t *destination, unsigned count)
+SSP::transfer(const uint16_t *source, uint16_t *destination, unsigned count)
 {
-    // missing all sorts of things here, but to start with...
-    auto txresid = source ? count : 0;
-    auto rxresid = destination ? count : 0;
+    transfer_sync(source, destination, count);
+}
 
-    while ((txresid > 0) || (rxresid > 0)) {
-        if ((txresid > 0) && (_reg.SR & SR_TNF_NOTFULL)) {
-            _reg.DR = *source++;
-            txresid--;
+template<typename T>
+void
+SSP::transfer_sync(const T *source, T *destination, unsigned count)
+{
+    auto fill = _fill[_index];
+
+    if (destination == nullptr) {
+        // Transmit-only; just keep the TX FIFO full and let the RX FIFO
+        // overrun, then clean up after the last frame has gone.
+        while (count > 0) {
+            if (_reg.SR & SR_TNF_NOTFULL) {
+                _reg.DR = source ? *source++ : fill;
+                count--;
+            }
         }
 
-        if ((rxresid > 0) && (_reg.SR & SR_RNE_NOTEMPTY)) {
-            *destination++ = _reg.DR;
-            rxresid--;
+        while (_reg.SR & SR_BSY_BUSY) {
         }
+
+        while (_reg.SR & SR_RNE_NOTEMPTY) {
+            (void)_reg.DR;
+        }
+
+        _reg.ICR = ICR_RORIC_CLEAR;
+        return;
+    }
+
+    // Full-duplex or receive-only; a receive-only transfer sends the fill
+    // word over and over.
+    T fill_word = fill;
+
+    if (source == nullptr) {
+        burst(_reg, &fill_word, 0, destination, count);
+    } else {
+        burst(_reg, source, 1, destination, count);
+    }
+}
+
+// Every frame sent produces one received, so there can never be more
+// than FIFO_DEPTH frames in flight without risking RX overrun. Fill the
+// TX FIFO, then run in lockstep; pop one word, push one word. Once a word
+// has been received there is always room in the TX FIFO, so SR only needs
+// to be polled for RNE. The steady-state loop is unrolled, and the kernels
+// run from RAM to avoid flash wait states.
+template<typename T>
+__always_inline void
+SSP::burst_kernel(LPC_SSP_TypeDef &reg, const T *source, unsigned step, T *destination, unsigned count)
+{
+    auto primed = (count < FIFO_DEPTH) ? count : FIFO_DEPTH;
+    auto txresid = count - primed;
+
+    for (auto i = primed; i > 0; i--) {
+        reg.DR = *source;
+        source += step;
+    }
+
+#define BURST_STEP                                  \
+    while (!(reg.SR & SR_RNE_NOTEMPTY)) {}          \
+    *destination++ = reg.DR;                        \
+    reg.DR = *source;                               \
+    source += step
+
+    while (txresid >= 4) {
+        BURST_STEP;
+        BURST_STEP;
+        BURST_STEP;
+        BURST_STEP;
+        txresid -= 4;
+    }
+
+    while (txresid > 0) {
+        BURST_STEP;
+        txresid--;
     }
+
+#undef BURST_STEP
+
+    // collect what is still in flight
+    for (auto i = primed; i > 0; i--) {
+        while (!(reg.SR & SR_RNE_NOTEMPTY)) {}
+
+        *destination++ = reg.DR;
+    }
+}
+
+__attribute__((section(".ramtext"), noinline, long_call)) void
+SSP::burst(LPC_SSP_TypeDef &reg, const uint8_t *source, unsigned step, uint8_t *destination, unsigned count)
+{
+    burst_kernel(reg, source, step, destination, count);
+}
+
+__attribute__((section(".ramtext"), noinline, long_call)) void
+SSP::burst(LPC_SSP_TypeDef &reg, const uint16_t *source, unsigned step, uint16_t *destination, unsigned count)
+{
+    burst_kernel(reg, source, step, destination, count);
 }
 
 void
-SSP::transfer(uint16_t *source, uint16_t *destination, unsigned count)
+SSP::transfer_microwire(const uint8_t *control, uint16_t *data, unsigned count)
 {
-    // missing all sorts of things here, but to start with...
-    auto txresid = source ? count : 0;
-    auto rxresid = destination ? count : 0;
+    // As for a full-duplex SPI transfer, every control word produces one
+    // received word, so the same in-flight limit applies.
+    auto fill = (uint8_t)_fill[_index];
+    auto txresid = count;
+    auto rxresid = count;
 
-    while ((txresid > 0) || (rxresid > 0)) {
-        if ((txresid > 0) && (_reg.SR & SR_TNF_NOTFULL)) {
-            _reg.DR = *source++;
+    while (rxresid > 0) {
+        if ((txresid > 0)
+            && ((rxresid - txresid) < FIFO_DEPTH)
+            && (_reg.SR & SR_TNF_NOTFULL)) {
+            _reg.DR = control ? *control++ : fill;
             txresid--;
         }
 
-        if ((rxresid > 0) && (_reg.SR & SR_RNE_NOTEMPTY)) {
-            *destination++ = _reg.DR;
+        if (_reg.SR & SR_RNE_NOTEMPTY) {
+            uint16_t word = _reg.DR;
+
+            if (data != nullptr) {
+                *data++ = word;
+            }
+
             rxresid--;
         }
     }
 }
+
+void
+SSP::acquire()
+{
+    for (;;) {
+        BEGIN_CRITICAL_SECTION;
+
+        // an interrupt-driven transfer can only start while the port is
+        // not held, so once it is held nothing else will start
+        if (!busy()) {
+            _held[_index] = true;
+            return;
+        }
+
+        END_CRITICAL_SECTION;
+    }
+}
+
+bool
+SSP::transfer_async(const uint8_t *source, uint8_t *destination, unsigned count, Callback callback)
+{
+    return start_async(source, destination, count, sizeof(uint8_t), callback);
+}
+
+bool
+SSP::transfer_async(const uint16_t *source, uint16_t *destination, unsigned count, Callback callback)
+{
+    return start_async(source, destination, count, sizeof(uint16_t), callback);
+}
+
+bool
+SSP::start_async(const void *source, void *destination, unsigned count, unsigned width, Callback callback)
+{
+    auto &a = _async[_index];
+
+    if (count == 0) {
+        return false;
+    }
+
+    BEGIN_CRITICAL_SECTION;
+
+    if (a.rxresid > 0) {
+        return false;
+    }
+
+    a.source = static_cast<const uint8_t *>(source);
+    a.destination = static_cast<uint8_t *>(destination);
+    a.width = width;
+    a.txresid = count;
+    a.rxresid = count;
+    a.callback = callback;
+
+    // Prime the TX FIFO; from here on the RX interrupts drive things.
+    // RX half-full covers the bulk of the transfer, and the RX timeout
+    // picks up the last few frames.
+    fill(a);
+    _reg.ICR = ICR_RORIC_CLEAR | ICR_RTIC_CLEAR;
+    _reg.IMSC = IMSC_RXIM_ENBL | IMSC_RTIM_ENBL;
+    _irq.enable();
+
+    END_CRITICAL_SECTION;
+
+    return true;
+}
+
+void
+SSP::fill(Async &a)
+{
+    // never have more frames in flight than the RX FIFO can hold
+    while ((a.txresid > 0)
+           && ((a.rxresid - a.txresid) < FIFO_DEPTH)
+           && (_reg.SR & SR_TNF_NOTFULL)) {
+        if (a.source == nullptr) {
+            _reg.DR = _fill[_index];
+        } else if (a.width == sizeof(uint16_t)) {
+            _reg.DR = *reinterpret_cast<const uint16_t *>(a.source);
+            a.source += sizeof(uint16_t);
+        } else {
+            _reg.DR = *a.source++;
+        }
+
+        a.txresid--;
+    }
+}
+
+void
+SSP::drain(Async &a)
+{
+    while ((a.rxresid > 0) && (_reg.SR & SR_RNE_NOTEMPTY)) {
+        uint16_t data = _reg.DR;
+
+        if (a.destination == nullptr) {
+            // discard
+        } else if (a.width == sizeof(uint16_t)) {
+            *reinterpret_cast<uint16_t *>(a.destination) = data;
+            a.destination += sizeof(uint16_t);
+        } else {
+            *a.destination++ = data;
+        }
+
+        a.rxresid--;
+    }
+}
+
+SSP &
+SSP::configure_slave(unsigned nbits, unsigned mode, Format format)
+{
+    // the divisors are ignored in slave mode, but SSP_PCLK must be fast
+    // enough to sample the host's clock
+    auto config = config_for(Syscon::PCLK_FREQ / 2, nbits, mode, format);
+
+    prescaler() = config.prescale;
+    _syscon.clock(true);
+    _syscon.reset();
+    slave_stop();
+    _reg.CPSR = config.cpsr;
+    _reg.CR0 = config.cr0;
+    _reg.CR1 = CR1_MS_SLAVE;
+
+    return *this;
+}
+
+void
+SSP::slave_start(const uint8_t *tx, uint8_t *rx0, uint8_t *rx1, unsigned length, FrameCallback callback)
+{
+    start_slave(tx, rx0, rx1, length * sizeof(uint8_t), callback);
+}
+
+void
+SSP::slave_start(const uint16_t *tx, uint16_t *rx0, uint16_t *rx1, unsigned length, FrameCallback callback)
+{
+    start_slave(tx, rx0, rx1, length * sizeof(uint16_t), callback);
+}
+
+void
+SSP::start_slave(const void *tx, void *rx0, void *rx1, unsigned length, FrameCallback callback)
+{
+    auto &sl = _slave[_index];
+
+    slave_stop();
+
+    if (!_syscon.running()) {
+        return;
+    }
+
+    // reset the block to empty both FIFOs of anything left over from a
+    // previous run, keeping the configuration
+    uint32_t cpsr = _reg.CPSR;
+    uint32_t cr0 = _reg.CR0;
+    _syscon.reset();
+    _reg.CPSR = cpsr;
+    _reg.CR0 = cr0;
+    _reg.CR1 = CR1_MS_SLAVE;
+
+    // lengths are kept in bytes so that the interrupt handler can use a
+    // single index for both widths
+    sl.tx = static_cast<const uint8_t *>(tx);
+    sl.armed = nullptr;
+    sl.txIndex = 0;
+    sl.rx[0] = static_cast<uint8_t *>(rx0);
+    sl.rx[1] = static_cast<uint8_t *>(rx1);
+    sl.rxBuffer = 0;
+    sl.rxIndex = 0;
+    sl.length = length;
+    sl.callback = callback;
+    sl.overruns = 0;
+
+    // Pre-load the TX FIFO so that the first words are ready when the host
+    // starts clocking, then enable the slave. After that, every RX
+    // half-full interrupt also tops up TX; the host clocks both FIFOs in
+    // lockstep, so TX is never more than half drained when we get there.
+    if ((_reg.CR0 & CR0_DSS_MASK) > CR0_DSS_8BIT) {
+        service_slave<uint16_t>(sl);
+    } else {
+        service_slave<uint8_t>(sl);
+    }
+
+    _reg.ICR = ICR_RORIC_CLEAR | ICR_RTIC_CLEAR;
+    _reg.IMSC = IMSC_RXIM_ENBL | IMSC_RTIM_ENBL | IMSC_RORIM_ENBL;
+    _reg.CR1 = CR1_MS_SLAVE | CR1_SSE_ENABLED;
+    _irq.enable();
+}
+
+void
+SSP::slave_stop()
+{
+    _slave[_index].length = 0;
+
+    // the registers can't be touched until the block has been set up
+    if (_syscon.running()) {
+        _reg.IMSC = 0;
+        _reg.CR1 = CR1_MS_SLAVE;
+    }
+}
+
+template<typename T>
+void
+SSP::service_slave(Slave &sl)
+{
+    // received words
+    while (_reg.SR & SR_RNE_NOTEMPTY) {
+        *reinterpret_cast<T *>(sl.rx[sl.rxBuffer] + sl.rxIndex) = _reg.DR;
+        sl.rxIndex += sizeof(T);
+
+        if (sl.rxIndex >= sl.length) {
+            auto frame = sl.rx[sl.rxBuffer];
+            sl.rxBuffer ^= 1;
+            sl.rxIndex = 0;
+
+            if (sl.callback != nullptr) {
+                sl.callback(_index, frame);
+            }
+        }
+    }
+
+    // words to send
+    while (_reg.SR & SR_TNF_NOTFULL) {
+        _reg.DR = *reinterpret_cast<const T *>(sl.tx + sl.txIndex);
+        sl.txIndex += sizeof(T);
+
+        if (sl.txIndex >= sl.length) {
+            const uint8_t *armed = sl.armed;
+
+            if (armed != nullptr) {
+                sl.tx = armed;
+                sl.armed = nullptr;
+            }
+
+            sl.txIndex = 0;
+        }
+    }
+}
+
+void
+SSP::interrupt()
+{
+    auto &sl = _slave[_index];
+
+    if (sl.length > 0) {
+        if (_reg.MIS & MIS_RORMIS_FRMRCVD) {
+            // we fell behind and words were lost, so there's no telling
+            // where the host's frames start; stop and report it rather
+            // than deliver misaligned frames
+            sl.overruns++;
+            slave_stop();
+
+            while (_reg.SR & SR_RNE_NOTEMPTY) {
+                (void)_reg.DR;
+            }
+
+            _reg.ICR = ICR_RORIC_CLEAR | ICR_RTIC_CLEAR;
+
+            if (sl.callback != nullptr) {
+                sl.callback(_index, nullptr);
+            }
+
+            return;
+        }
+
+        if ((_reg.CR0 & CR0_DSS_MASK) > CR0_DSS_8BIT) {
+            service_slave<uint16_t>(sl);
+        } else {
+            service_slave<uint8_t>(sl);
+        }
+
+        _reg.ICR = ICR_RTIC_CLEAR;
+        return;
+    }
+
+    auto &a = _async[_index];
+
+    // nothing in flight; a stray interrupt must not repeat the callback
+    if (a.rxresid == 0) {
+        _reg.IMSC = 0;
+        return;
+    }
+
+    drain(a);
+    _reg.ICR = ICR_RTIC_CLEAR;
+    fill(a);
+
+    if (a.rxresid == 0) {
+        _reg.IMSC = 0;
+
+        // the callback may start the next transfer
+        auto callback = a.callback;
+        a.callback = nullptr;
+
+        if (callback != nullptr) {
+            callback(_index);
+        }
+    }
+}
+
+void
+SSP0_Handler(void)
+{
+    SSP0.interrupt();
+}
+
+void
+SSP1_Handler(void)
+{
+    SSP1.interrupt();
+}
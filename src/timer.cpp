@@ -29,58 +29,312 @@
 #include <interrupt.h>
 #include <uart.h>
 
-Timer::Callback Timer::_callbacks[4];
-uint64_t        _Timebase::_time;
+Timer::Slot     Timer::_slots[4][NUM_CHANNELS];
+uint8_t         Timer::_oneshot[4];
+uint8_t         Timer::_triggered[4];
+uint64_t        _Timebase::_snapshot[2];
+volatile unsigned _Timebase::_sequence;
+uint64_t        _Timebase::_alarmTime;
+Timer::Callback _Timebase::_alarmCallback;
+void            *_Timebase::_alarmContext;
+
+void
+Timer::set_callback(Channel channel, Callback callback, void *context)
+{
+    BEGIN_CRITICAL_SECTION;
+    _slots[_index][channel] = { callback, context };
+    END_CRITICAL_SECTION;
+}
+
+void
+Timer::trigger(Channel channel)
+{
+    BEGIN_CRITICAL_SECTION;
+    _triggered[_index] |= 1U << channel;
+    _irq.enable();
+    _irq.set_pending();
+    END_CRITICAL_SECTION;
+}
+
+void
+Timer::periodic(uint32_t interval, Callback callback, void *context)
+{
+    cancel();
+    _regs.CTCR = CTCR_CTMODE_TIMER;
+    _regs.PR = (Syscon::PCLK_FREQ / 1000000) - 1;        // count microseconds
+    _regs.MR0 = interval - 1;
+    _regs.MCR = MCR_MR0_INT_ENABLED | MCR_MR0_RESET_ENABLED;
+    set_callback(CHANNEL_MR0, callback, context);
+    _regs.TCR = TCR_COUNTERENABLE_ENABLED | TCR_COUNTERRESET_DISABLED;
+    _irq.enable();
+}
+
+void
+Timer::free_run(uint32_t prescale)
+{
+    cancel();
+    _regs.CTCR = CTCR_CTMODE_TIMER;
+    _regs.PR = prescale - 1;
+    _regs.TCR = TCR_COUNTERENABLE_ENABLED | TCR_COUNTERRESET_DISABLED;
+    _irq.enable();
+}
+
+void
+Timer::timeout(Channel channel, uint32_t ticks, Callback callback, void *context)
+{
+    if (channel > CHANNEL_MR3) {
+        return;
+    }
+
+    auto mask = max_count();
+    auto &match = (&_regs.MR0)[channel];
+
+    BEGIN_CRITICAL_SECTION;
+
+    _slots[_index][channel] = { callback, context };
+    _oneshot[_index] |= 1U << channel;
+
+    uint32_t start = _regs.TC;
+    match = (start + ticks) & mask;
+    _regs.IR = 1U << channel;
+    _regs.MCR |= match_interrupt(channel);
+
+    // too close to catch the match
+    if (((_regs.TC - start) & mask) >= ticks) {
+        trigger(channel);
+    }
+
+    END_CRITICAL_SECTION;
+}
+
+void
+Timer::cancel_timeout(Channel channel)
+{
+    BEGIN_CRITICAL_SECTION;
+    disable_channel(channel);
+    _oneshot[_index] &= ~(1U << channel);
+    _triggered[_index] &= ~(1U << channel);
+    END_CRITICAL_SECTION;
+}
+
+void
+Timer::disable_channel(Channel channel)
+{
+    BEGIN_CRITICAL_SECTION;
+
+    if (channel == CHANNEL_CR0) {
+        _regs.CCR &= ~CCR_CAP0I_MASK;
+    } else {
+        _regs.MCR &= ~match_interrupt(channel);
+    }
+
+    END_CRITICAL_SECTION;
+}
+
+void
+Timer::interrupt(void)
+{
+    // read IR once and service everything it shows, plus anything
+    // triggered in software
+    uint32_t flags = _regs.IR;
+    _regs.IR = flags;
+
+    BEGIN_CRITICAL_SECTION;
+    flags |= _triggered[_index];
+    _triggered[_index] = 0;
+    END_CRITICAL_SECTION;
+
+    for (auto channel = 0U; channel < NUM_CHANNELS; channel++) {
+        if (!(flags & (1U << channel))) {
+            continue;
+        }
+
+        auto slot = _slots[_index][channel];
+
+        if (_oneshot[_index] & (1U << channel)) {
+            BEGIN_CRITICAL_SECTION;
+            _oneshot[_index] &= ~(1U << channel);
+            END_CRITICAL_SECTION;
+            disable_channel((Channel)channel);
+        }
+
+        if (slot.callback != nullptr) {
+            slot.callback(_index, (Channel)channel, slot.context);
+        } else {
+            disable_channel((Channel)channel);
+        }
+    }
+}
 
 void
 _Timebase::configure()
 {
     cancel();
-    _time = 0;
+    _snapshot[0] = 0;
+    _snapshot[1] = 0;
+    _sequence = 0;
+    _alarmCallback = nullptr;
     _regs.CTCR = CTCR_CTMODE_TIMER;
     _regs.PR = (Syscon::PCLK_FREQ / 1000000) - 1;        // count microseconds
     _regs.MR0 = max_count();                             // interrupt around about wrap time
     _regs.MR1 = max_count() / 2;                         // and again at ~halftime
     _regs.MCR = MCR_MR0_INT_ENABLED | MCR_MR1_INT_ENABLED;
-    _callbacks[_index] = &_Timebase::handler;
+    set_callback(CHANNEL_MR0, &_Timebase::handler);
+    set_callback(CHANNEL_MR1, &_Timebase::handler);
+    set_callback(CHANNEL_MR2, &_Timebase::alarm);
     _regs.TCR = TCR_COUNTERENABLE_ENABLED | TCR_COUNTERRESET_DISABLED;
     _irq.enable();
 }
 
+void
+_Timebase::service()
+{
+    // with interrupts masked the handler can't run, so a caller spinning
+    // on time() has to publish the snapshot itself or the count will wrap
+    // underneath it; clear the flags first so that a match after this
+    // point is still seen
+    if (__get_PRIMASK() && (_regs.IR & (IR_MR0 | IR_MR1))) {
+        _regs.IR = IR_MR0 | IR_MR1;
+        publish();
+    }
+}
+
+uint64_t
+_Timebase::extended()
+{
+    // the snapshot must be read before the counter, so that it is never
+    // newer than the count
+    auto snap = snapshot();
+    uint32_t count = _regs.TC;
+    uint32_t mask = max_count();
+
+    // split the time into bits we own and bits that the timer owns
+    uint32_t old_count = snap & mask;
+    uint64_t tb_high = snap ^ old_count;
+
+    // handle a wrap since the snapshot was taken
+    if (count < old_count) {
+        tb_high += (uint64_t)mask + 1;
+    }
+
+    return tb_high | count;
+}
+
+void
+_Timebase::publish()
+{
+    // we are the only writer; fill the buffer readers aren't using, then
+    // switch them over to it
+    auto now = extended();
+    auto next = _sequence + 1;
+
+    _snapshot[next & 1] = now;
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    _sequence = next;
+}
+
 uint64_t
 _Timebase::time()
 {
-    BEGIN_CRITICAL_SECTION;
+    service();
+    return extended();
+}
 
-    // clear any match interrupts - we're about to do the same work
-    _regs.IR = _regs.IR;
+uint32_t
+_Timebase::time32()
+{
+    uint32_t mask = max_count();
 
-    // work out whether this is a 16 or 32-bit timer
-    uint64_t mask = _regs.MR0;
+    if (mask == 0xffffffff) {
+        return _regs.TC;
+    }
 
-    // split the time into bits we own and bits that the timer owns
-    uint32_t old_count = _time & mask;
-    uint64_t tb_high = _time ^ old_count;
+    service();
 
-    // get the current low bits
+    // as for time(), but only the low word of the snapshot matters
+    uint32_t snap = snapshot();
     uint32_t count = _regs.TC;
+    uint32_t old_count = snap & mask;
+    uint32_t tb_high = snap ^ old_count;
 
-    // handle possible wrap since the last time we were called
     if (count < old_count) {
         tb_high += mask + 1;
     }
 
-    _time = tb_high | count;
+    return tb_high | count;
+}
+
+bool
+_Timebase::absorb_wakeup()
+{
+    service();
+
+    // a match, or a software trigger whose pend we must not discard
+    if ((_regs.IR != 0) || (_triggered[_index] != 0)) {
+        return false;
+    }
+
+    // the interrupt line is level-sensitive, so if a match came in after
+    // IR was read this pends again
+    _irq.clear_pending();
+
+    return (NVIC->ISPR[0] == 0)
+           && !(SCB->ICSR & (SCB_ICSR_PENDSTSET_Msk | SCB_ICSR_PENDSVSET_Msk));
+}
+
+void
+_Timebase::set_alarm(microseconds when, Callback callback, void *context)
+{
+    BEGIN_CRITICAL_SECTION;
 
-    return _time;
+    _alarmTime = when;
+    _alarmCallback = callback;
+    _alarmContext = context;
+
+    // MR2 matches once per counter period, so the handler checks that the
+    // alarm is really due; distant alarms just see a few early wakeups
+    _regs.MR2 = when & max_count();
+    _regs.MCR |= MCR_MR2_INT_ENABLED;
+
+    // if the count passed MR2 before it was written, the match has been
+    // missed and won't come round again for a whole period
+    if (time() >= when) {
+        trigger(CHANNEL_MR2);
+    }
 
     END_CRITICAL_SECTION;
 }
 
 void
-_Timebase::handler(unsigned index)
+_Timebase::cancel_alarm()
 {
-    _Timebase(index).time();
+    BEGIN_CRITICAL_SECTION;
+    _regs.MCR &= ~MCR_MR2_INT_MASK;
+    _alarmCallback = nullptr;
+    END_CRITICAL_SECTION;
+}
+
+void
+_Timebase::handler(unsigned index, Channel channel, void *context)
+{
+    (void)channel;
+    (void)context;
+    _Timebase(index).publish();
+}
+
+void
+_Timebase::alarm(unsigned index, Channel channel, void *context)
+{
+    (void)context;
+    auto tb = _Timebase(index);
+
+    // one-shot; the callback may set a new alarm
+    if ((_alarmCallback != nullptr) && (tb.time() >= _alarmTime)) {
+        auto callback = _alarmCallback;
+        auto callbackContext = _alarmContext;
+        tb.cancel_alarm();
+        callback(index, channel, callbackContext);
+    }
 }
 
 void
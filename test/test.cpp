@@ -24,7 +24,7 @@ main0()
     P0_9_MOSI0.configure();
     SSP0.configure(2400000, 8, 0);
     uint8_t c = 0x55;
-    SSP0.transfer(&c, nullptr, 1);
+    SSP0.send(&c, 1);
 
     // I2C
     I2C0.writeRegister(0x22, 1, 1);
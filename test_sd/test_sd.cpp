@@ -0,0 +1,86 @@
+//
+// SD card throughput: compare multi-block (CMD18/CMD25) transfers against
+// the same blocks moved one at a time (CMD17/CMD24).
+//
+// WARNING: overwrites blocks 1000-1007 of the card.
+//
+
+#include <syscon.h>
+#include <pin.h>
+#include <uart.h>
+#include <timer.h>
+#include <ssp.h>
+#include <sd_card.h>
+#include <debug.h>
+
+static const uint32_t   FIRST_BLOCK = 1000;
+static const uint32_t   BLOCKS = 8;
+
+static uint8_t          buf[BLOCKS * SdCard::BLOCK_SIZE];
+
+static void
+report(const char *what, uint32_t start, SdCard::Status status)
+{
+    unsigned long elapsed = Timebase.time32() - start;
+
+    if (status != SdCard::OK) {
+        debug("%s failed %d", what, status);
+    } else {
+        debug("%s %lu us, %lu kB/s", what, elapsed,
+              (unsigned long)(sizeof(buf) * 1000UL) / (elapsed ? elapsed : 1));
+    }
+}
+
+void
+main()
+{
+    Timebase.configure();
+
+    P1_7_TXD.configure();
+    P1_6_RXD.configure();
+    UART0.configure(115200);
+
+    P0_6_SCK0_0_6.configure();
+    P0_8_MISO0.configure();
+    P0_9_MOSI0.configure();
+    SdCard sd(0, P0_2, 12000000);
+
+    auto status = sd.init();
+
+    if (status != SdCard::OK) {
+        debug("init failed %d", status);
+        for (;;) {
+        }
+    }
+
+    for (;;) {
+        auto start = Timebase.time32();
+        status = SdCard::OK;
+
+        for (auto i = 0U; (i < BLOCKS) && (status == SdCard::OK); i++) {
+            status = sd.read(FIRST_BLOCK + i, buf + i * SdCard::BLOCK_SIZE, 1);
+        }
+
+        report("read single", start, status);
+
+        start = Timebase.time32();
+        report("read multi", start, sd.read(FIRST_BLOCK, buf, BLOCKS));
+
+        start = Timebase.time32();
+        status = SdCard::OK;
+
+        for (auto i = 0U; (i < BLOCKS) && (status == SdCard::OK); i++) {
+            status = sd.write(FIRST_BLOCK + i, buf + i * SdCard::BLOCK_SIZE, 1);
+        }
+
+        report("write single", start, status);
+
+        start = Timebase.time32();
+        report("write multi", start, sd.write(FIRST_BLOCK, buf, BLOCKS));
+
+        start = Timebase.time32();
+
+        while ((Timebase.time32() - start) < 2000000) {
+        }
+    }
+}
@@ -0,0 +1,100 @@
+//
+// Timebase read cost: compare time(), time32() and ticks() against the
+// original implementation, which masked interrupts around every read.
+//
+
+#include <syscon.h>
+#include <pin.h>
+#include <uart.h>
+#include <timer.h>
+#include <interrupt.h>
+#include <debug.h>
+
+// The locked time() as it was before the snapshot rework, for comparison.
+// IR is written with 0 rather than with itself so as not to steal matches
+// from the real Timebase; the bus cost is the same.
+class LockedTimebase : public Timer
+{
+public:
+    constexpr LockedTimebase(unsigned index) :
+        Timer(index)
+    {}
+
+    uint64_t
+    time()
+    {
+        BEGIN_CRITICAL_SECTION;
+
+        _regs.IR = 0;
+
+        uint64_t mask = _regs.MR0;
+        uint32_t old_count = _time & mask;
+        uint64_t tb_high = _time ^ old_count;
+        uint32_t count = _regs.TC;
+
+        if (count < old_count) {
+            tb_high += mask + 1;
+        }
+
+        _time = tb_high | count;
+
+        return _time;
+
+        END_CRITICAL_SECTION;
+    }
+
+private:
+    static uint64_t     _time;
+};
+
+uint64_t LockedTimebase::_time;
+
+// Average cost of f() in cycles; SysTick counts down at the core clock,
+// so this is only good for well under one SysTick period.
+template<typename F>
+static unsigned
+cycles(F f)
+{
+    unsigned reload = SysTick->LOAD + 1;
+    unsigned start = SysTick->VAL;
+
+    for (auto i = 0; i < 10; i++) {
+        f();
+    }
+
+    unsigned end = SysTick->VAL;
+    return ((start + reload - end) % reload) / 10;
+}
+
+void
+main()
+{
+    Timebase.configure();
+
+    P1_7_TXD.configure();
+    P1_6_RXD.configure();
+    UART0.configure(115200);
+
+    // free-running SysTick at the core clock, no interrupt
+    SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+
+    volatile uint64_t sink64;
+    volatile uint32_t sink32;
+    auto locked = LockedTimebase(CONFIG_TIMEBASE_TIMER);
+
+    for (;;) {
+        auto loop = cycles([&] { sink32 = 0; });
+
+        debug("locked time() cycles %u", cycles([&] { sink64 = locked.time(); }) - loop);
+        debug("time() cycles %u", cycles([&] { sink64 = Timebase.time(); }) - loop);
+        debug("time32() cycles %u", cycles([&] { sink32 = Timebase.time32(); }) - loop);
+        debug("ticks() cycles %u", cycles([&] { sink32 = Timebase.ticks(); }) - loop);
+
+        auto start = Timebase.time32();
+
+        while ((Timebase.time32() - start) < 1000000) {
+        }
+    }
+}
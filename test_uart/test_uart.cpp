@@ -27,16 +27,16 @@ main()
     UART0 << "loopback test start\n";
 
     unsigned i = 0;
-    uint64_t t, r;
+    uint32_t t = 0, r = 0;
     for (;;) {
         uint8_t c;
 
         if (UART0.recv(c)) {
             UART0.send(c);
             i++;
-            t = Timebase.time();
+            t = Timebase.time32();
         } else {
-            if (((Timebase.time() - t) > 1000000) 
+            if (((Timebase.time32() - t) > 1000000) 
                 && (t != r)) {
                 debug("%d", i);
                 r = t;